@@ -99,6 +99,35 @@ static const struct row_queue_params row_queues_def[] = {
 #define ROW_IDLE_TIME_MSEC 5
 #define ROW_READ_FREQ_MSEC 20
 
+/*
+ * Latency histograms: bucket 0 counts requests that waited less than 1ms,
+ * bucket i (i > 0) those that waited [2^(i-1), 2^i) ms. The last bucket
+ * also takes everything above.
+ */
+#define ROW_LAT_BUCKETS		12
+
+/*
+ * Read latency adaptation (see row_adapt_latency()). Evaluated every
+ * ROW_ADAPT_WINDOW completions of a queue; the quantum of a read queue
+ * that misses its target is doubled at most ROW_ADAPT_MAX_SHIFT times.
+ */
+#define ROW_ADAPT_WINDOW	32
+#define ROW_ADAPT_MAX_SHIFT	3
+#define ROW_ADAPT_MAX_IDLE_SHIFT 2
+/* Default read latency targets (in msec) */
+#define ROW_HP_READ_LAT_TARGET_MSEC	20
+#define ROW_RP_READ_LAT_TARGET_MSEC	50
+
+static const char * const row_queue_name[] = {
+	"hp_read",
+	"hp_swrite",
+	"rp_read",
+	"rp_swrite",
+	"rp_write",
+	"lp_read",
+	"lp_swrite",
+};
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
@@ -111,6 +140,25 @@ struct rowq_idling_data {
 	bool			begin_idling;
 };
 
+/**
+ * struct rowq_lat_data - latency statistics of a queue
+ * @disp_hist:		histogram of the time from insertion to dispatch
+ * @cmpl_hist:		histogram of the time from insertion to completion
+ * @avg_cmpl_us:	moving average of the completion latency (usec)
+ * @nr_cmpl:		completions in the current adaptation window
+ * @target_ms:		completion latency target, 0 if none (msec)
+ * @quantum_shift:	the dispatch quantum is scaled by 2^quantum_shift
+ *
+ */
+struct rowq_lat_data {
+	unsigned long		disp_hist[ROW_LAT_BUCKETS];
+	unsigned long		cmpl_hist[ROW_LAT_BUCKETS];
+	u32			avg_cmpl_us;
+	unsigned int		nr_cmpl;
+	int			target_ms;
+	unsigned int		quantum_shift;
+};
+
 /**
  * struct row_queue - requests grouping structure
  * @rdata:		parent row_data structure
@@ -122,6 +170,7 @@ struct rowq_idling_data {
  * @dispatch quantum:	number of requests this queue may
  *			dispatch in a dispatch cycle
  * @idle_data:		data for idling on queues
+ * @lat_data:		latency statistics and adaptation state
  *
  */
 struct row_queue {
@@ -136,6 +185,8 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	struct rowq_lat_data	lat_data;
 };
 
 /**
@@ -187,6 +238,9 @@ struct starvation_data {
  * @reg_prio_starvation: starvation data for REGULAR priority queues
  * @low_prio_starvation: starvation data for LOW priority queues
  * @cycle_flags:	used for marking unserved queueus
+ * @lat_adapt:		flag indicating whether quanta and idle time are
+ *			adapted to meet the read latency targets
+ * @idle_shift:		the idle time is scaled by 2^idle_shift
  *
  */
 struct row_data {
@@ -206,6 +260,9 @@ struct row_data {
 	struct starvation_data		low_prio_starvation;
 
 	unsigned int			cycle_flags;
+
+	bool				lat_adapt;
+	unsigned int			idle_shift;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elv.priv[0]))
@@ -246,6 +303,102 @@ static inline void __maybe_unused row_dump_queues_stat(struct row_data *rd)
 			rd->row_queues[i].nr_req);
 }
 
+/*
+ * The insertion time is kept in the request itself, in usec truncated to
+ * 32 bits; that wraps after ~71 minutes, which is fine for differences.
+ * Zero means the request never went through row_add_request() (flushes
+ * and requests inserted straight into the dispatch queue), so it is
+ * never stored as a time.
+ */
+static inline void row_set_insert_time(struct request *rq)
+{
+	u32 now = (u32)ktime_to_us(ktime_get());
+
+	rq->elv.priv[1] = (void *)(unsigned long)(now ?: 1);
+}
+
+static inline bool row_rq_has_insert_time(struct request *rq)
+{
+	return rq->elv.priv[1] != NULL;
+}
+
+static inline u32 row_rq_wait_us(struct request *rq)
+{
+	return (u32)ktime_to_us(ktime_get()) -
+		(u32)(unsigned long)rq->elv.priv[1];
+}
+
+static inline int row_lat_bucket(u32 lat_us)
+{
+	return min_t(int, fls(lat_us / USEC_PER_MSEC), ROW_LAT_BUCKETS - 1);
+}
+
+/* Dispatch quantum of the queue, including the latency adaptation */
+static inline int row_queue_quantum(struct row_queue *rqueue)
+{
+	unsigned int shift = rqueue->lat_data.quantum_shift;
+
+	if (rqueue->disp_quantum > (INT_MAX >> shift))
+		return INT_MAX;
+	return rqueue->disp_quantum << shift;
+}
+
+static inline s64 row_idle_time_ms(struct row_data *rd)
+{
+	return rd->rd_idle_data.idle_time_ms << rd->idle_shift;
+}
+
+/*
+ * row_adapt_latency() - Adapt the scheduling parameters of a queue
+ * @rd:		pointer to struct row_data
+ * @rqueue:	queue that completed a full adaptation window
+ *
+ * A queue whose average completion latency is above its target gets a
+ * larger share of its priority class' dispatch cycle. Once it is back
+ * under half the target the boost is given back one step at a time.
+ * The idle time follows the largest read boost, so that a reader issuing
+ * requests back to back is not overtaken by writes between two of them.
+ *
+ */
+static void row_adapt_latency(struct row_data *rd, struct row_queue *rqueue)
+{
+	struct rowq_lat_data *lat = &rqueue->lat_data;
+	u32 target_us = lat->target_ms * USEC_PER_MSEC;
+	unsigned int idle_shift = 0;
+	int i;
+
+	if (lat->target_ms && lat->avg_cmpl_us > target_us) {
+		if (lat->quantum_shift >= ROW_ADAPT_MAX_SHIFT)
+			return;
+		lat->quantum_shift++;
+	} else if (lat->quantum_shift &&
+		   (!lat->target_ms || lat->avg_cmpl_us < target_us / 2)) {
+		lat->quantum_shift--;
+	} else {
+		return;
+	}
+	row_log_rowq(rd, rqueue->prio, "avg latency %uus, quantum now %d",
+		lat->avg_cmpl_us, row_queue_quantum(rqueue));
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		if (row_queues_def[i].idling_enabled)
+			idle_shift = max(idle_shift,
+				rd->row_queues[i].lat_data.quantum_shift);
+	rd->idle_shift = min_t(unsigned int, idle_shift,
+			       ROW_ADAPT_MAX_IDLE_SHIFT);
+}
+
+static void row_reset_adaptation(struct row_data *rd)
+{
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		rd->row_queues[i].lat_data.quantum_shift = 0;
+		rd->row_queues[i].lat_data.nr_cmpl = 0;
+	}
+	rd->idle_shift = 0;
+}
+
 /******************** Static helper functions ***********************/
 static void kick_queue(struct work_struct *work)
 {
@@ -336,6 +489,7 @@ static void row_add_request(struct request_queue *q,
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rqueue->nr_req++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	row_set_insert_time(rq);
 
 	if (rq->cmd_flags & REQ_URGENT) {
 		WARN_ON(1);
@@ -450,6 +604,21 @@ static int row_reinsert_req(struct request_queue *q,
 static void row_completed_req(struct request_queue *q, struct request *rq)
 {
 	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+	struct rowq_lat_data *lat;
+	u32 lat_us;
+
+	if (rqueue && row_rq_has_insert_time(rq)) {
+		lat = &rqueue->lat_data;
+		lat_us = row_rq_wait_us(rq);
+		lat->cmpl_hist[row_lat_bucket(lat_us)]++;
+		/* 1/8 weight for the new sample */
+		lat->avg_cmpl_us += (s32)(lat_us - lat->avg_cmpl_us) / 8;
+		if (rd->lat_adapt && ++lat->nr_cmpl >= ROW_ADAPT_WINDOW) {
+			lat->nr_cmpl = 0;
+			row_adapt_latency(rd, rqueue);
+		}
+	}
 
 	 if (rq->cmd_flags & REQ_URGENT) {
 		if (!rd->urgent_in_flight) {
@@ -522,6 +691,9 @@ static void row_dispatch_insert(struct row_data *rd, struct request *rq)
 	struct row_queue *rqueue = RQ_ROWQ(rq);
 
 	row_remove_request(rd, rq);
+	if (row_rq_has_insert_time(rq))
+		rqueue->lat_data.disp_hist[
+			row_lat_bucket(row_rq_wait_us(rq))]++;
 	elv_dispatch_sort(rd->dispatch_queue, rq);
 	if (rq->cmd_flags & REQ_URGENT) {
 		WARN_ON(rd->urgent_in_flight);
@@ -642,7 +814,7 @@ check_idling:
 
 initiate_idling:
 	hrtimer_start(&rd->rd_idle_data.hr_timer,
-		ktime_set(0, rd->rd_idle_data.idle_time_ms * NSEC_PER_MSEC),
+		ktime_set(0, row_idle_time_ms(rd) * NSEC_PER_MSEC),
 		HRTIMER_MODE_REL);
 
 	rd->rd_idle_data.idling_queue_idx = i;
@@ -660,7 +832,7 @@ static void row_restart_cycle(struct row_data *rd,
 	row_dump_queues_stat(rd);
 	for (i = start_idx; i < end_idx; i++) {
 		if (rd->row_queues[i].nr_dispatched <
-		    rd->row_queues[i].disp_quantum)
+		    row_queue_quantum(&rd->row_queues[i]))
 			row_mark_rowq_unserved(rd, i);
 		rd->row_queues[i].nr_dispatched = 0;
 	}
@@ -688,7 +860,7 @@ static int row_get_next_queue(struct request_queue *q, struct row_data *rd,
 	do {
 		if (list_empty(&rd->row_queues[i].fifo) ||
 		    rd->row_queues[i].nr_dispatched >=
-		    rd->row_queues[i].disp_quantum) {
+		    row_queue_quantum(&rd->row_queues[i])) {
 			i++;
 			if (i == end_idx && restart) {
 				/* Restart cycle for this priority class */
@@ -801,6 +973,11 @@ static void *row_init_queue(struct request_queue *q)
 			ktime_set(0, 0);
 	}
 
+	rdata->row_queues[ROWQ_PRIO_HIGH_READ].lat_data.target_ms =
+			ROW_HP_READ_LAT_TARGET_MSEC;
+	rdata->row_queues[ROWQ_PRIO_REG_READ].lat_data.target_ms =
+			ROW_RP_READ_LAT_TARGET_MSEC;
+
 	rdata->reg_prio_starvation.starvation_limit =
 			ROW_REG_STARVATION_TOLLERANCE;
 	rdata->low_prio_starvation.starvation_limit =
@@ -935,6 +1112,7 @@ row_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
 	spin_lock_irqsave(q->queue_lock, flags);
 	rq->elv.priv[0] =
 		(void *)(&rd->row_queues[row_get_queue_prio(rq, rd)]);
+	rq->elv.priv[1] = NULL;
 	spin_unlock_irqrestore(q->queue_lock, flags);
 
 	return 0;
@@ -981,6 +1159,11 @@ SHOW_FUNCTION(row_reg_starv_limit_show,
 	rowd->reg_prio_starvation.starvation_limit);
 SHOW_FUNCTION(row_low_starv_limit_show,
 	rowd->low_prio_starvation.starvation_limit);
+SHOW_FUNCTION(row_hp_read_lat_target_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_READ].lat_data.target_ms);
+SHOW_FUNCTION(row_rp_read_lat_target_show,
+	rowd->row_queues[ROWQ_PRIO_REG_READ].lat_data.target_ms);
+SHOW_FUNCTION(row_lat_adapt_show, rowd->lat_adapt);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)			\
@@ -1027,9 +1210,93 @@ STORE_FUNCTION(row_reg_starv_limit_store,
 STORE_FUNCTION(row_low_starv_limit_store,
 			&rowd->low_prio_starvation.starvation_limit,
 			1, INT_MAX);
+STORE_FUNCTION(row_hp_read_lat_target_store,
+			&rowd->row_queues[ROWQ_PRIO_HIGH_READ].lat_data.target_ms,
+			0, 10000);
+STORE_FUNCTION(row_rp_read_lat_target_store,
+			&rowd->row_queues[ROWQ_PRIO_REG_READ].lat_data.target_ms,
+			0, 10000);
 
 #undef STORE_FUNCTION
 
+static ssize_t row_lat_adapt_store(struct elevator_queue *e,
+		const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct request_queue *q = rowd->dispatch_queue;
+	int __data;
+	int ret = row_var_store(&__data, (page), count);
+
+	spin_lock_irq(q->queue_lock);
+	rowd->lat_adapt = !!__data;
+	/* Restart from the configured quanta and idle time */
+	row_reset_adaptation(rowd);
+	spin_unlock_irq(q->queue_lock);
+	return ret;
+}
+
+/*
+ * Per queue latency histograms, one line per queue and kind (disp: time
+ * from insertion to dispatch, cmpl: time from insertion to completion),
+ * followed by the average completion latency and the current quantum of
+ * each queue. Writing anything clears the histograms.
+ */
+static ssize_t row_lat_hist_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct rowq_lat_data *lat;
+	ssize_t sz = 0;
+	int i, j;
+
+	sz += scnprintf(page + sz, PAGE_SIZE - sz, "%-16s", "below_ms");
+	for (j = 0; j < ROW_LAT_BUCKETS - 1; j++)
+		sz += scnprintf(page + sz, PAGE_SIZE - sz, " %10u", 1U << j);
+	sz += scnprintf(page + sz, PAGE_SIZE - sz, " %10s\n", "inf");
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		lat = &rowd->row_queues[i].lat_data;
+		sz += scnprintf(page + sz, PAGE_SIZE - sz, "%-11s_disp",
+				row_queue_name[i]);
+		for (j = 0; j < ROW_LAT_BUCKETS; j++)
+			sz += scnprintf(page + sz, PAGE_SIZE - sz, " %10lu",
+					lat->disp_hist[j]);
+		sz += scnprintf(page + sz, PAGE_SIZE - sz, "\n%-11s_cmpl",
+				row_queue_name[i]);
+		for (j = 0; j < ROW_LAT_BUCKETS; j++)
+			sz += scnprintf(page + sz, PAGE_SIZE - sz, " %10lu",
+					lat->cmpl_hist[j]);
+		sz += scnprintf(page + sz, PAGE_SIZE - sz, "\n");
+	}
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		sz += scnprintf(page + sz, PAGE_SIZE - sz,
+				"%s: avg_cmpl_us=%u quantum=%d\n",
+				row_queue_name[i],
+				rowd->row_queues[i].lat_data.avg_cmpl_us,
+				row_queue_quantum(&rowd->row_queues[i]));
+	sz += scnprintf(page + sz, PAGE_SIZE - sz, "idle_time_ms=%lld\n",
+			row_idle_time_ms(rowd));
+	return sz;
+}
+
+static ssize_t row_lat_hist_store(struct elevator_queue *e,
+		const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct request_queue *q = rowd->dispatch_queue;
+	int i;
+
+	spin_lock_irq(q->queue_lock);
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		memset(rowd->row_queues[i].lat_data.disp_hist, 0,
+		       sizeof(rowd->row_queues[i].lat_data.disp_hist));
+		memset(rowd->row_queues[i].lat_data.cmpl_hist, 0,
+		       sizeof(rowd->row_queues[i].lat_data.cmpl_hist));
+	}
+	spin_unlock_irq(q->queue_lock);
+	return count;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
@@ -1046,6 +1313,10 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(rd_idle_data_freq),
 	ROW_ATTR(reg_starv_limit),
 	ROW_ATTR(low_starv_limit),
+	ROW_ATTR(hp_read_lat_target),
+	ROW_ATTR(rp_read_lat_target),
+	ROW_ATTR(lat_adapt),
+	ROW_ATTR(lat_hist),
 	__ATTR_NULL
 };
 
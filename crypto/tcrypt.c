@@ -33,6 +33,8 @@
 #include <linux/jiffies.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
+#include <linux/random.h>
+#include <linux/slab.h>
 #include "tcrypt.h"
 #include "internal.h"
 
@@ -64,7 +66,7 @@ static char *check[] = {
 	"cast6", "arc4", "michael_mic", "deflate", "crc32c", "tea", "xtea",
 	"khazad", "wp512", "wp384", "wp256", "tnepres", "xeta",  "fcrypt",
 	"camellia", "seed", "salsa20", "rmd128", "rmd160", "rmd256", "rmd320",
-	"lzo", "cts", "zlib", NULL
+	"lzo", "cts", "zlib", "lz4", NULL
 };
 
 static int test_cipher_jiffies(struct blkcipher_desc *desc, int enc,
@@ -920,6 +922,187 @@ out:
 	crypto_free_ablkcipher(tfm);
 }
 
+/*
+ * Page sized inputs roughly matching what zram sees: a mostly zero page,
+ * a page of repetitive text and a page of incompressible data.
+ */
+enum { COMP_INPUT_SPARSE, COMP_INPUT_TEXT, COMP_INPUT_RANDOM, COMP_INPUTS };
+
+static const char *comp_input_names[COMP_INPUTS] = {
+	"sparse", "text", "random",
+};
+
+static void comp_fill_input(u8 *buf, int kind)
+{
+	static const char text[] = "I/ActivityManager( 1234): Start proc ";
+	int i;
+
+	switch (kind) {
+	case COMP_INPUT_SPARSE:
+		memset(buf, 0, PAGE_SIZE);
+		for (i = 0; i < PAGE_SIZE; i += 512)
+			*(u32 *)(buf + i) = i * 2654435761u;
+		break;
+	case COMP_INPUT_TEXT:
+		for (i = 0; i < PAGE_SIZE; i++)
+			buf[i] = text[i % (sizeof(text) - 1)] + (i / 997) % 3;
+		break;
+	case COMP_INPUT_RANDOM:
+		get_random_bytes(buf, PAGE_SIZE);
+		break;
+	}
+}
+
+static int test_comp_jiffies(struct crypto_comp *tfm, int dec, const u8 *src,
+			     unsigned int slen, u8 *dst, int sec)
+{
+	unsigned long start, end;
+	unsigned int dlen;
+	int bcount;
+	int ret;
+
+	for (start = jiffies, end = start + sec * HZ, bcount = 0;
+	     time_before(jiffies, end); bcount++) {
+		dlen = 2 * PAGE_SIZE;
+		if (dec)
+			ret = crypto_comp_decompress(tfm, src, slen, dst, &dlen);
+		else
+			ret = crypto_comp_compress(tfm, src, slen, dst, &dlen);
+		if (ret)
+			return ret;
+	}
+
+	printk("%6u opers/sec, %9lu bytes/sec\n",
+	       bcount / sec, ((long)bcount * PAGE_SIZE) / sec);
+
+	return 0;
+}
+
+static int test_comp_cycles(struct crypto_comp *tfm, int dec, const u8 *src,
+			    unsigned int slen, u8 *dst)
+{
+	unsigned long cycles = 0;
+	unsigned int dlen;
+	int ret = 0;
+	int i;
+
+	local_bh_disable();
+	local_irq_disable();
+
+	/* Warm-up run. */
+	for (i = 0; i < 4; i++) {
+		dlen = 2 * PAGE_SIZE;
+		if (dec)
+			ret = crypto_comp_decompress(tfm, src, slen, dst, &dlen);
+		else
+			ret = crypto_comp_compress(tfm, src, slen, dst, &dlen);
+		if (ret)
+			goto out;
+	}
+
+	/* The real thing. */
+	for (i = 0; i < 8; i++) {
+		cycles_t start, end;
+
+		start = get_cycles();
+
+		dlen = 2 * PAGE_SIZE;
+		if (dec)
+			ret = crypto_comp_decompress(tfm, src, slen, dst, &dlen);
+		else
+			ret = crypto_comp_compress(tfm, src, slen, dst, &dlen);
+		if (ret)
+			goto out;
+
+		end = get_cycles();
+
+		cycles += end - start;
+	}
+
+out:
+	local_irq_enable();
+	local_bh_enable();
+
+	if (ret == 0)
+		printk("%6lu cycles/operation, %4lu cycles/byte\n",
+		       cycles / 8, cycles / (8 * PAGE_SIZE));
+
+	return ret;
+}
+
+/*
+ * Compress and decompress single pages, the unit zram works in, so the
+ * compressors it can be configured with are compared on equal terms.
+ */
+static void test_comp_speed(const char *algo, unsigned int sec)
+{
+	struct crypto_comp *tfm;
+	u8 *src, *cbuf, *dbuf;
+	unsigned int clen, dlen;
+	int kind, ret;
+
+	printk(KERN_INFO "\ntesting speed of %s\n", algo);
+
+	tfm = crypto_alloc_comp(algo, 0, CRYPTO_ALG_ASYNC);
+	if (IS_ERR(tfm)) {
+		printk(KERN_ERR "failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	src = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	cbuf = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
+	dbuf = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
+	if (!src || !cbuf || !dbuf)
+		goto out;
+
+	for (kind = 0; kind < COMP_INPUTS; kind++) {
+		comp_fill_input(src, kind);
+
+		clen = 2 * PAGE_SIZE;
+		ret = crypto_comp_compress(tfm, src, PAGE_SIZE, cbuf, &clen);
+		if (ret) {
+			printk(KERN_ERR "%s: compression failed on %s page\n",
+			       algo, comp_input_names[kind]);
+			continue;
+		}
+		dlen = 2 * PAGE_SIZE;
+		ret = crypto_comp_decompress(tfm, cbuf, clen, dbuf, &dlen);
+		if (ret || dlen != PAGE_SIZE || memcmp(src, dbuf, PAGE_SIZE)) {
+			printk(KERN_ERR "%s: round trip failed on %s page\n",
+			       algo, comp_input_names[kind]);
+			continue;
+		}
+
+		printk(KERN_INFO "test %s page (%lu -> %u bytes): compress ",
+		       comp_input_names[kind], PAGE_SIZE, clen);
+		if (sec)
+			ret = test_comp_jiffies(tfm, 0, src, PAGE_SIZE,
+						dbuf, sec);
+		else
+			ret = test_comp_cycles(tfm, 0, src, PAGE_SIZE, dbuf);
+		if (ret)
+			break;
+
+		printk(KERN_INFO "test %s page: decompress ",
+		       comp_input_names[kind]);
+		if (sec)
+			ret = test_comp_jiffies(tfm, 1, cbuf, clen, dbuf, sec);
+		else
+			ret = test_comp_cycles(tfm, 1, cbuf, clen, dbuf);
+		if (ret)
+			break;
+	}
+
+	if (ret)
+		printk(KERN_ERR "%s: speed test failed: %d\n", algo, ret);
+out:
+	kfree(dbuf);
+	kfree(cbuf);
+	kfree(src);
+	crypto_free_comp(tfm);
+}
+
 static void test_available(void)
 {
 	char **name = check;
@@ -1563,6 +1746,24 @@ static int do_test(int m)
 				   speed_template_32_64);
 		break;
 
+	case 600:
+		/* fall through */
+
+	case 601:
+		test_comp_speed("lzo", sec);
+		if (mode > 600 && mode < 700) break;
+
+	case 602:
+		test_comp_speed("lz4", sec);
+		if (mode > 600 && mode < 700) break;
+
+	case 603:
+		test_comp_speed("deflate", sec);
+		if (mode > 600 && mode < 700) break;
+
+	case 699:
+		break;
+
 	case 1000:
 		test_available();
 		break;
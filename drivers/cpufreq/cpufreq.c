@@ -32,6 +32,12 @@
 
 #include <trace/events/power.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_governor.h>
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(cpufreq_governor_load);
+EXPORT_TRACEPOINT_SYMBOL_GPL(cpufreq_governor_target);
+
 /**
  * The "cpufreq driver" - the arch- or hardware-dependent low
  * level driver of CPUFreq support, and its spinlock. This lock
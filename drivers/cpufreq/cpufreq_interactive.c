@@ -34,6 +34,8 @@
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/cpufreq_interactive.h>
+#undef CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_governor.h>
 
 static atomic_t active_count = ATOMIC_INIT(0);
 
@@ -112,6 +114,18 @@ static struct cpufreq_interactive_inputopen inputopen;
 
 static int boost_val;
 
+/*
+ * Non-zero means also act on scheduler wakeups: raise a CPU to hispeed
+ * when a task is queued behind another, and to the speed of the CPU a
+ * task migrated from, without waiting for the next timer sample.
+ */
+static int sched_mode_val;
+static bool sched_mode_registered;
+static DEFINE_MUTEX(sched_mode_lock);
+
+/* Runnable tasks, the woken one included, that take a CPU to hispeed */
+#define SCHED_MODE_NR_RUNNING 2
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -195,6 +209,9 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (load_since_change > cpu_load)
 		cpu_load = load_since_change;
 
+	trace_cpufreq_governor_load("interactive", data, cpu_load,
+				    pcpu->policy->cur);
+
 	if (cpu_load >= go_hispeed_load || boost_val) {
 		if (pcpu->target_freq <= pcpu->policy->min) {
 			new_freq = hispeed_freq;
@@ -255,6 +272,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 
 	trace_cpufreq_interactive_target(data, cpu_load, pcpu->target_freq,
 					 new_freq);
+	trace_cpufreq_governor_target("interactive", data, pcpu->target_freq,
+				      new_freq);
 	pcpu->target_set_time_in_idle = now_idle;
 	pcpu->target_set_time = pcpu->timer_run_time;
 
@@ -491,6 +510,75 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 	}
 }
 
+/* Raise one CPU to at least new_freq, as a boost would */
+static void cpufreq_interactive_raise(int cpu, unsigned int new_freq)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	unsigned long flags;
+	int raised = 0;
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+	if (pcpu->governor_enabled && pcpu->target_freq < new_freq) {
+		pcpu->target_freq = new_freq;
+		cpumask_set_cpu(cpu, &up_cpumask);
+		pcpu->target_set_time_in_idle =
+			get_cpu_idle_time_us(cpu, &pcpu->target_set_time);
+		pcpu->hispeed_validate_time = pcpu->target_set_time;
+		pcpu->floor_freq = new_freq;
+		pcpu->floor_validate_time = pcpu->target_set_time;
+		raised = 1;
+	}
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+	if (raised)
+		wake_up_process(up_task);
+}
+
+static int cpufreq_interactive_sched_notifier(struct notifier_block *nb,
+					      unsigned long val, void *data)
+{
+	struct sched_wakeup_notify_data *wd = data;
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, wd->dest_cpu);
+	unsigned int new_freq = 0;
+
+	if (!pcpu->governor_enabled)
+		return NOTIFY_OK;
+
+	if (wd->nr_running >= SCHED_MODE_NR_RUNNING)
+		new_freq = hispeed_freq;
+	else if (wd->src_cpu != wd->dest_cpu)
+		new_freq = min_t(unsigned int, hispeed_freq,
+				 per_cpu(cpuinfo, wd->src_cpu).target_freq);
+
+	if (new_freq > pcpu->target_freq) {
+		trace_cpufreq_interactive_sched(wd->dest_cpu, wd->src_cpu,
+						wd->nr_running,
+						pcpu->target_freq, new_freq);
+		cpufreq_interactive_raise(wd->dest_cpu, new_freq);
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block cpufreq_interactive_sched_nb = {
+	.notifier_call = cpufreq_interactive_sched_notifier,
+};
+
+/* Listen to the scheduler only while the mode is on and we govern a CPU */
+static void cpufreq_interactive_sched_mode_update(void)
+{
+	bool want;
+
+	mutex_lock(&sched_mode_lock);
+	want = sched_mode_val && atomic_read(&active_count);
+	if (want && !sched_mode_registered)
+		sched_wakeup_notifier_register(&cpufreq_interactive_sched_nb);
+	else if (!want && sched_mode_registered)
+		sched_wakeup_notifier_unregister(&cpufreq_interactive_sched_nb);
+	sched_mode_registered = want;
+	mutex_unlock(&sched_mode_lock);
+}
+
 static void cpufreq_interactive_boost(void)
 {
 	int i;
@@ -798,6 +886,29 @@ static ssize_t store_boostpulse(struct kobject *kobj, struct attribute *attr,
 static struct global_attr boostpulse =
 	__ATTR(boostpulse, 0200, NULL, store_boostpulse);
 
+static ssize_t show_sched_mode(struct kobject *kobj, struct attribute *attr,
+			       char *buf)
+{
+	return sprintf(buf, "%d\n", sched_mode_val);
+}
+
+static ssize_t store_sched_mode(struct kobject *kobj, struct attribute *attr,
+				const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	sched_mode_val = !!val;
+	cpufreq_interactive_sched_mode_update();
+	return count;
+}
+
+define_one_global_rw(sched_mode);
+
 static struct attribute *interactive_attributes[] = {
 	&hispeed_freq_attr.attr,
 	&go_hispeed_load_attr.attr,
@@ -807,6 +918,7 @@ static struct attribute *interactive_attributes[] = {
 	&input_boost.attr,
 	&boost.attr,
 	&boostpulse.attr,
+	&sched_mode.attr,
 	NULL,
 };
 
@@ -871,6 +983,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pr_warn("%s: failed to register input handler\n",
 				__func__);
 
+		cpufreq_interactive_sched_mode_update();
+
 		break;
 
 	case CPUFREQ_GOV_STOP:
@@ -893,6 +1007,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		cpufreq_interactive_sched_mode_update();
+
 		input_unregister_handler(&cpufreq_interactive_input_handler);
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
@@ -25,6 +25,7 @@
 #include <linux/input.h>
 #include <linux/workqueue.h>
 #include <linux/slab.h>
+#include <trace/events/cpufreq_governor.h>
 
 /*
  * dbs is used in this file as a shortform for demandbased switching
@@ -683,6 +684,7 @@ static void dbs_freq_increase(struct cpufreq_policy *p, unsigned int freq)
 	else if (p->cur == p->max)
 		return;
 
+	trace_cpufreq_governor_target("ondemand", p->cpu, p->cur, freq);
 	__cpufreq_driver_target(p, freq, dbs_tuners_ins.powersave_bias ?
 			CPUFREQ_RELATION_L : CPUFREQ_RELATION_H);
 }
@@ -812,6 +814,8 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	load_at_max_freq = (cur_load * policy->cur)/policy->cpuinfo.max_freq;
 
 	cpufreq_notify_utilization(policy, load_at_max_freq);
+	trace_cpufreq_governor_load("ondemand", policy->cpu,
+				    max_load_freq / policy->cur, policy->cur);
 	/* Check for frequency increase */
 	if (max_load_freq > dbs_tuners_ins.up_threshold * policy->cur) {
 		/* If switching to max speed, apply sampling_down_factor */
@@ -880,11 +884,15 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 
 		}
 		if (!dbs_tuners_ins.powersave_bias) {
+			trace_cpufreq_governor_target("ondemand", policy->cpu,
+						      policy->cur, freq_next);
 			__cpufreq_driver_target(policy, freq_next,
 					CPUFREQ_RELATION_L);
 		} else {
 			int freq = powersave_bias_target(policy, freq_next,
 					CPUFREQ_RELATION_L);
+			trace_cpufreq_governor_target("ondemand", policy->cpu,
+						      policy->cur, freq);
 			__cpufreq_driver_target(policy, freq,
 				CPUFREQ_RELATION_L);
 		}
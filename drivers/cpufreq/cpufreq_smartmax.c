@@ -39,6 +39,7 @@
 #include <linux/kthread.h>
 #include <linux/slab.h>
 #include <linux/kernel_stat.h>
+#include <trace/events/cpufreq_governor.h>
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
 #include <linux/earlysuspend.h>
@@ -361,6 +362,7 @@ inline static void target_freq(struct cpufreq_policy *policy,
 
 	dprintk(SMARTMAX_DEBUG_JUMPS, "%d: jumping to %d (%d) cpu %d\n", old_freq, new_freq, target, cpu);
 
+	trace_cpufreq_governor_target("smartmax", policy->cpu, old_freq, target);
 	__cpufreq_driver_target(policy, target, prefered_relation);
 
 	// remember last time we changed frequency
@@ -532,6 +534,7 @@ static void cpufreq_smartmax_timer(struct smartmax_info_s *this_smartmax) {
 	}
 
 	dprintk(SMARTMAX_DEBUG_LOAD, "%d: load %d\n", cur, debug_load);
+	trace_cpufreq_governor_load("smartmax", this_smartmax->cpu, debug_load, cur);
 
 	this_smartmax->cur_cpu_load = debug_load;
 	this_smartmax->old_freq = cur;
@@ -207,6 +207,10 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	kref_init(&buffer->ref);
 
 	ret = heap->ops->allocate(heap, buffer, len, align, flags);
+	/* Memory may still be sitting on the heap's deferred free list */
+	if (ret && (heap->flags & ION_HEAP_FLAG_DEFER_FREE) &&
+	    ion_heap_freelist_drain(heap))
+		ret = heap->ops->allocate(heap, buffer, len, align, flags);
 	if (ret) {
 		kfree(buffer);
 		return ERR_PTR(ret);
@@ -261,11 +265,8 @@ static void ion_iommu_delayed_unmap(struct ion_buffer *buffer)
 	mutex_unlock(&buffer->lock);
 }
 
-static void ion_buffer_destroy(struct kref *kref)
+void ion_buffer_release(struct ion_buffer *buffer)
 {
-	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
-	struct ion_device *dev = buffer->dev;
-
 	if (WARN_ON(buffer->kmap_cnt > 0))
 		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
 
@@ -273,10 +274,23 @@ static void ion_buffer_destroy(struct kref *kref)
 
 	ion_iommu_delayed_unmap(buffer);
 	buffer->heap->ops->free(buffer);
+	kfree(buffer);
+}
+
+static void ion_buffer_destroy(struct kref *kref)
+{
+	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
+	struct ion_device *dev = buffer->dev;
+	struct ion_heap *heap = buffer->heap;
+
 	mutex_lock(&dev->lock);
 	rb_erase(&buffer->node, &dev->buffers);
 	mutex_unlock(&dev->lock);
-	kfree(buffer);
+
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
+		ion_heap_freelist_add(heap, buffer);
+	else
+		ion_buffer_release(buffer);
 }
 
 static void ion_buffer_get(struct ion_buffer *buffer)
@@ -1647,6 +1661,8 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 		}
 	}
 	ion_heap_print_debug(s, heap);
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
+		ion_heap_freelist_print(s, heap);
 	mutex_unlock(&dev->lock);
 	return 0;
 }
@@ -1674,6 +1690,13 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 		pr_err("%s: can not add heap with invalid ops struct.\n",
 		       __func__);
 
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE &&
+	    ion_heap_init_deferred_free(heap)) {
+		pr_err("%s: could not start the deferred free thread for %s\n",
+		       __func__, heap->name);
+		heap->flags &= ~ION_HEAP_FLAG_DEFER_FREE;
+	}
+
 	heap->dev = dev;
 	mutex_lock(&dev->lock);
 	while (*p) {
@@ -16,7 +16,11 @@
  */
 
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/ion.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
 #include "ion_priv.h"
 #include <linux/msm_ion.h>
 
@@ -64,11 +68,23 @@ struct ion_heap *ion_heap_create(struct ion_platform_heap *heap_data)
 	return heap;
 }
 
+/* Heaps with ION_HEAP_FLAG_DEFER_FREE, so that the shrinker can find them */
+static LIST_HEAD(deferred_heaps);
+static DEFINE_MUTEX(deferred_heaps_lock);
+
 void ion_heap_destroy(struct ion_heap *heap)
 {
 	if (!heap)
 		return;
 
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE && heap->task) {
+		mutex_lock(&deferred_heaps_lock);
+		list_del(&heap->deferred_node);
+		mutex_unlock(&deferred_heaps_lock);
+		kthread_stop(heap->task);
+		ion_heap_freelist_drain(heap);
+	}
+
 	switch ((int) heap->type) {
 	case ION_HEAP_TYPE_SYSTEM_CONTIG:
 		ion_system_contig_heap_destroy(heap);
@@ -95,3 +111,168 @@ void ion_heap_destroy(struct ion_heap *heap)
 		       heap->type);
 	}
 }
+
+void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	buffer->free_time = ktime_get();
+
+	spin_lock(&heap->free_lock);
+	list_add_tail(&buffer->list, &heap->free_list);
+	heap->free_list_size += buffer->size;
+	if (++heap->free_list_count > heap->free_max_count)
+		heap->free_max_count = heap->free_list_count;
+	spin_unlock(&heap->free_lock);
+
+	wake_up(&heap->waitqueue);
+}
+
+/*
+ * Take everything queued so far and free it as one batch, so the thread
+ * wakes up once per burst of frees rather than once per buffer.
+ */
+static size_t ion_heap_free_batch(struct ion_heap *heap)
+{
+	struct ion_buffer *buffer, *tmp;
+	LIST_HEAD(batch);
+	unsigned long lat_us, max_lat_us = 0;
+	u64 total_lat_us = 0;
+	unsigned int count = 0;
+	size_t size;
+
+	spin_lock(&heap->free_lock);
+	list_splice_init(&heap->free_list, &batch);
+	size = heap->free_list_size;
+	heap->free_list_size = 0;
+	heap->free_list_count = 0;
+	spin_unlock(&heap->free_lock);
+
+	list_for_each_entry_safe(buffer, tmp, &batch, list) {
+		ktime_t queued = buffer->free_time;
+
+		list_del(&buffer->list);
+		ion_buffer_release(buffer);
+
+		lat_us = ktime_us_delta(ktime_get(), queued);
+		total_lat_us += lat_us;
+		max_lat_us = max(max_lat_us, lat_us);
+		count++;
+	}
+
+	if (count) {
+		spin_lock(&heap->free_lock);
+		heap->free_total += count;
+		heap->free_lat_us += total_lat_us;
+		heap->free_max_lat_us = max(heap->free_max_lat_us, max_lat_us);
+		spin_unlock(&heap->free_lock);
+	}
+	return size;
+}
+
+size_t ion_heap_freelist_drain(struct ion_heap *heap)
+{
+	if (!(heap->flags & ION_HEAP_FLAG_DEFER_FREE))
+		return 0;
+	return ion_heap_free_batch(heap);
+}
+
+/*
+ * Called by the page pool shrinker before it shrinks the pools: buffers
+ * still queued hold pages that only reach the pools, and so become
+ * reclaimable, once they are freed.
+ */
+size_t ion_heap_freelist_shrink(void)
+{
+	struct ion_heap *heap;
+	size_t size = 0;
+
+	mutex_lock(&deferred_heaps_lock);
+	list_for_each_entry(heap, &deferred_heaps, deferred_node)
+		size += ion_heap_free_batch(heap);
+	mutex_unlock(&deferred_heaps_lock);
+	return size;
+}
+
+size_t ion_heap_freelist_total(void)
+{
+	struct ion_heap *heap;
+	size_t size = 0;
+
+	mutex_lock(&deferred_heaps_lock);
+	list_for_each_entry(heap, &deferred_heaps, deferred_node) {
+		spin_lock(&heap->free_lock);
+		size += heap->free_list_size;
+		spin_unlock(&heap->free_lock);
+	}
+	mutex_unlock(&deferred_heaps_lock);
+	return size;
+}
+
+static bool ion_heap_freelist_empty(struct ion_heap *heap)
+{
+	bool empty;
+
+	spin_lock(&heap->free_lock);
+	empty = list_empty(&heap->free_list);
+	spin_unlock(&heap->free_lock);
+	return empty;
+}
+
+static int ion_heap_deferred_free(void *data)
+{
+	struct ion_heap *heap = data;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		wait_event_freezable(heap->waitqueue,
+				     !ion_heap_freelist_empty(heap) ||
+				     kthread_should_stop());
+		ion_heap_free_batch(heap);
+	}
+	return 0;
+}
+
+int ion_heap_init_deferred_free(struct ion_heap *heap)
+{
+	INIT_LIST_HEAD(&heap->free_list);
+	spin_lock_init(&heap->free_lock);
+	init_waitqueue_head(&heap->waitqueue);
+
+	heap->task = kthread_run(ion_heap_deferred_free, heap, "ion_free_%s",
+				 heap->name);
+	if (IS_ERR(heap->task)) {
+		heap->task = NULL;
+		return -ENOMEM;
+	}
+	/* Freeing is never urgent, stay out of the way of the UI */
+	set_user_nice(heap->task, 19);
+
+	mutex_lock(&deferred_heaps_lock);
+	list_add_tail(&heap->deferred_node, &deferred_heaps);
+	mutex_unlock(&deferred_heaps_lock);
+	return 0;
+}
+
+void ion_heap_freelist_print(struct seq_file *s, struct ion_heap *heap)
+{
+	unsigned int count, max_count;
+	unsigned long total, max_lat_us;
+	size_t size;
+	u64 avg_lat_us;
+
+	spin_lock(&heap->free_lock);
+	count = heap->free_list_count;
+	size = heap->free_list_size;
+	max_count = heap->free_max_count;
+	total = heap->free_total;
+	avg_lat_us = heap->free_lat_us;
+	max_lat_us = heap->free_max_lat_us;
+	spin_unlock(&heap->free_lock);
+
+	if (total)
+		do_div(avg_lat_us, total);
+
+	seq_printf(s, "deferred free: %u buffers (%zu bytes) queued, max %u\n",
+		   count, size, max_count);
+	seq_printf(s, "deferred free: %lu freed, latency avg %llu us, max %lu us\n",
+		   total, avg_lat_us, max_lat_us);
+}
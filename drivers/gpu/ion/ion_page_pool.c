@@ -0,0 +1,204 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/shrinker.h>
+#include <asm/cacheflush.h>
+#include "ion_priv.h"
+
+/* All pools, so that the shrinker can find them */
+static LIST_HEAD(pools);
+static DEFINE_MUTEX(pools_lock);
+
+/*
+ * Pages handed out by a pool are zero and clean in every level of cache,
+ * so that the allocator does not have to touch them at all. That work is
+ * done once, when the pages enter the pool.
+ */
+static void ion_page_pool_prepare(struct ion_page_pool *pool,
+				  struct page *page, bool zero)
+{
+	void *vaddr = page_address(page);
+	unsigned long size = PAGE_SIZE << pool->order;
+	phys_addr_t paddr = page_to_phys(page);
+
+	if (zero)
+		memset(vaddr, 0, size);
+	dmac_flush_range(vaddr, vaddr + size);
+	outer_flush_range(paddr, paddr + size);
+}
+
+static struct page *ion_page_pool_alloc_pages(struct ion_page_pool *pool)
+{
+	struct page *page = alloc_pages(pool->gfp_mask | __GFP_ZERO,
+					pool->order);
+
+	if (!page)
+		return NULL;
+	ion_page_pool_prepare(pool, page, false);
+	return page;
+}
+
+static struct page *ion_page_pool_remove(struct ion_page_pool *pool)
+{
+	struct page *page;
+
+	BUG_ON(!pool->count);
+	page = list_first_entry(&pool->items, struct page, lru);
+	list_del(&page->lru);
+	pool->count--;
+	return page;
+}
+
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	mutex_lock(&pool->mutex);
+	if (pool->count) {
+		page = ion_page_pool_remove(pool);
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	mutex_unlock(&pool->mutex);
+
+	if (page)
+		return page;
+	return ion_page_pool_alloc_pages(pool);
+}
+
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	ion_page_pool_prepare(pool, page, true);
+
+	mutex_lock(&pool->mutex);
+	list_add_tail(&page->lru, &pool->items);
+	pool->count++;
+	mutex_unlock(&pool->mutex);
+}
+
+int ion_page_pool_total(struct ion_page_pool *pool)
+{
+	return pool->count << pool->order;
+}
+
+/*
+ * Give up to nr_to_scan pages worth of the pool back to the page
+ * allocator. Returns the number of pages freed.
+ */
+static int ion_page_pool_shrink_one(struct ion_page_pool *pool,
+				    int nr_to_scan)
+{
+	int freed = 0;
+	LIST_HEAD(victims);
+	struct page *page, *tmp;
+
+	mutex_lock(&pool->mutex);
+	while (pool->count && freed < nr_to_scan) {
+		page = ion_page_pool_remove(pool);
+		list_add(&page->lru, &victims);
+		freed += 1 << pool->order;
+	}
+	mutex_unlock(&pool->mutex);
+
+	list_for_each_entry_safe(page, tmp, &victims, lru) {
+		list_del(&page->lru);
+		__free_pages(page, pool->order);
+	}
+	return freed;
+}
+
+static int ion_page_pool_shrink(struct shrinker *shrinker,
+				struct shrink_control *sc)
+{
+	struct ion_page_pool *pool;
+	int nr_to_scan = sc->nr_to_scan;
+	int nr_total = 0;
+
+	/*
+	 * Buffers waiting for their heap's deferred free thread go back to
+	 * the pools first, so that their pages can be shrunk right away.
+	 */
+	if (nr_to_scan > 0)
+		ion_heap_freelist_shrink();
+
+	mutex_lock(&pools_lock);
+	/* Pools are kept low order first, high order pools go last */
+	list_for_each_entry(pool, &pools, list) {
+		if (nr_to_scan > 0)
+			nr_to_scan -= ion_page_pool_shrink_one(pool,
+							       nr_to_scan);
+		nr_total += ion_page_pool_total(pool);
+	}
+	mutex_unlock(&pools_lock);
+
+	return nr_total + (ion_heap_freelist_total() >> PAGE_SHIFT);
+}
+
+static struct shrinker ion_page_pool_shrinker = {
+	.shrink = ion_page_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
+{
+	struct ion_page_pool *pool, *pos;
+
+	pool = kzalloc(sizeof(struct ion_page_pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	INIT_LIST_HEAD(&pool->items);
+	mutex_init(&pool->mutex);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+
+	mutex_lock(&pools_lock);
+	list_for_each_entry(pos, &pools, list)
+		if (pos->order > order)
+			break;
+	list_add_tail(&pool->list, &pos->list);
+	mutex_unlock(&pools_lock);
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	mutex_lock(&pools_lock);
+	list_del(&pool->list);
+	mutex_unlock(&pools_lock);
+
+	ion_page_pool_shrink_one(pool, INT_MAX);
+	kfree(pool);
+}
+
+static int __init ion_page_pool_init(void)
+{
+	register_shrinker(&ion_page_pool_shrinker);
+	return 0;
+}
+
+static void __exit ion_page_pool_exit(void)
+{
+	unregister_shrinker(&ion_page_pool_shrinker);
+}
+
+module_init(ion_page_pool_init);
+module_exit(ion_page_pool_exit);
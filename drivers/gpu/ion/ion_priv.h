@@ -19,9 +19,13 @@
 #define _ION_PRIV_H
 
 #include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/ion.h>
 #include <linux/iommu.h>
 #include <linux/seq_file.h>
@@ -81,6 +85,8 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @vaddr:		the kenrel mapping if kmap_cnt is not zero
  * @dmap_cnt:		number of times the buffer is mapped for dma
  * @sg_table:		the sg table for the buffer if dmap_cnt is not zero
+ * @list:		node in the heap's free list when freeing is deferred
+ * @free_time:		when the buffer was queued for deferred freeing
 */
 struct ion_buffer {
 	struct kref ref;
@@ -102,6 +108,8 @@ struct ion_buffer {
 	unsigned int iommu_map_cnt;
 	struct rb_root iommu_maps;
 	int marked;
+	struct list_head list;
+	ktime_t free_time;
 };
 
 /**
@@ -160,6 +168,19 @@ struct ion_heap_ops {
  *			MUST be unique
  * @name:		used for debugging
  * @priv:		private heap data
+ * @flags:		ION_HEAP_FLAG_* set by the heap implementation
+ * @free_list:		buffers waiting to be freed, if ION_HEAP_FLAG_DEFER_FREE
+ * @free_lock:		protects free_list and the counters below
+ * @free_list_count:	number of buffers on free_list
+ * @free_list_size:	bytes on free_list
+ * @free_max_count:	largest free_list_count seen
+ * @free_total:		buffers freed by the deferred free thread
+ * @free_lat_us:	sum of the time those buffers spent queued and freeing
+ * @free_max_lat_us:	longest such time
+ * @waitqueue:		wakes the deferred free thread
+ * @task:		the deferred free thread
+ * @deferred_node:	node in the list of heaps with a free_list, used by
+ *			the page pool shrinker
  *
  * Represents a pool of memory from which buffers can be made.  In some
  * systems the only heap is regular system memory allocated via vmalloc.
@@ -174,8 +195,26 @@ struct ion_heap {
 	int id;
 	const char *name;
 	void *priv;
+	unsigned long flags;
+	struct list_head free_list;
+	spinlock_t free_lock;
+	unsigned int free_list_count;
+	size_t free_list_size;
+	unsigned int free_max_count;
+	unsigned long free_total;
+	u64 free_lat_us;
+	unsigned long free_max_lat_us;
+	wait_queue_head_t waitqueue;
+	struct task_struct *task;
+	struct list_head deferred_node;
 };
 
+/*
+ * Buffers of heaps with this flag are freed by a per heap thread instead
+ * of in the context that dropped the last reference.
+ */
+#define ION_HEAP_FLAG_DEFER_FREE	(1 << 0)
+
 /**
  * struct mem_map_data - represents information about the memory map for a heap
  * @node:		rb node used to store in the tree of mem_map_data
@@ -229,6 +268,27 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap);
 struct ion_heap *ion_heap_create(struct ion_platform_heap *);
 void ion_heap_destroy(struct ion_heap *);
 
+/**
+ * ion_buffer_release - unmap and free a buffer that has no references left
+ * @buffer:		the buffer, already removed from the device
+ */
+void ion_buffer_release(struct ion_buffer *buffer);
+
+/**
+ * functions for heaps with ION_HEAP_FLAG_DEFER_FREE
+ * ion_heap_init_deferred_free starts the thread that frees the buffers
+ * queued with ion_heap_freelist_add. ion_heap_freelist_drain frees all
+ * queued buffers in the caller's context and returns the number of bytes
+ * released. ion_heap_freelist_shrink does the same for every such heap,
+ * and ion_heap_freelist_total returns the bytes queued on all of them.
+ */
+int ion_heap_init_deferred_free(struct ion_heap *heap);
+void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer);
+size_t ion_heap_freelist_drain(struct ion_heap *heap);
+size_t ion_heap_freelist_shrink(void);
+size_t ion_heap_freelist_total(void);
+void ion_heap_freelist_print(struct seq_file *s, struct ion_heap *heap);
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *);
 void ion_system_heap_destroy(struct ion_heap *);
 
@@ -313,4 +373,37 @@ void ion_cp_heap_get_base(struct ion_heap *heap, unsigned long *base,
 
 void ion_mem_map_show(struct ion_heap *heap);
 
+/**
+ * struct ion_page_pool - pagepool struct
+ * @count:		number of items in the pool
+ * @hits:		allocations served from the pool
+ * @misses:		allocations that went to the page allocator
+ * @items:		list of pages, linked through page->lru
+ * @mutex:		protects the fields above
+ * @gfp_mask:		gfp_mask to use when allocating new pages
+ * @order:		order of the pages in the pool
+ * @list:		node in the list of all pools, used by the shrinker
+ *
+ * Allows you to keep a pool of pre-zeroed, cache clean pages for a
+ * particular order so that the common allocation sizes do not have to go
+ * through the page allocator and cache maintenance every time. Pools are
+ * drained by a shrinker when the system is under memory pressure.
+ */
+struct ion_page_pool {
+	int count;
+	unsigned long hits;
+	unsigned long misses;
+	struct list_head items;
+	struct mutex mutex;
+	gfp_t gfp_mask;
+	unsigned int order;
+	struct list_head list;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
+void ion_page_pool_destroy(struct ion_page_pool *);
+struct page *ion_page_pool_alloc(struct ion_page_pool *);
+void ion_page_pool_free(struct ion_page_pool *, struct page *);
+int ion_page_pool_total(struct ion_page_pool *);
+
 #endif /* _ION_PRIV_H */
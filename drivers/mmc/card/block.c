@@ -136,6 +136,7 @@ struct mmc_blk_data {
 	struct device_attribute power_ro_lock;
 	int	area_type;
 	struct device_attribute num_wr_reqs_to_start_packing;
+	struct device_attribute wr_pack_budget_us;
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -320,6 +321,34 @@ num_wr_reqs_to_start_packing_store(struct device *dev,
 	return count;
 }
 
+static ssize_t
+wr_pack_budget_us_show(struct device *dev,
+		       struct device_attribute *attr, char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	int ret;
+
+	ret = snprintf(buf, PAGE_SIZE, "%u\n", md->queue.wr_pack_budget_us);
+
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t
+wr_pack_budget_us_store(struct device *dev,
+			struct device_attribute *attr,
+			const char *buf, size_t count)
+{
+	unsigned int value;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	if (!kstrtouint(buf, 0, &value))
+		md->queue.wr_pack_budget_us = value;
+
+	mmc_blk_put(md);
+	return count;
+}
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -1498,9 +1527,95 @@ static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
 	else
 		mqrq->mmc_active.err_check = mmc_blk_err_check;
 
+	mqrq->issue_time = ktime_get();
 	mmc_queue_bounce_pre(mqrq);
 }
 
+/* While packing does not pay off, still try it every so many writes */
+#define MMC_BLK_PACK_PROBE	64
+
+/*
+ * Account the completion of a request: its service time starts when it
+ * was issued or, if it was queued behind the previous request on the
+ * host, when that one completed. Write throughput is tracked separately
+ * for single and packed writes.
+ */
+static void mmc_blk_update_wr_tput(struct mmc_queue *mq,
+				   struct mmc_queue_req *mqrq)
+{
+	struct mmc_wr_pack_stats *stats = &mq->card->wr_pack_stats;
+	ktime_t now = ktime_get();
+	ktime_t start = mqrq->issue_time;
+	unsigned int bytes;
+	u32 *tput;
+	s64 us;
+	u64 kbps;
+
+	if (ktime_to_ns(mq->last_done) > ktime_to_ns(start))
+		start = mq->last_done;
+	mq->last_done = now;
+
+	if (rq_data_dir(mqrq->req) != WRITE)
+		return;
+
+	if (mqrq->packed_cmd != MMC_PACKED_NONE) {
+		bytes = mqrq->packed_blocks << 9;
+		tput = &stats->packed_wr_tput;
+	} else {
+		bytes = mqrq->brq.data.bytes_xfered;
+		tput = &stats->single_wr_tput;
+	}
+
+	us = ktime_us_delta(now, start);
+	if (us <= 0 || !bytes)
+		return;
+
+	kbps = (u64)bytes * USEC_PER_SEC;
+	do_div(kbps, (u32)min_t(s64, us, UINT_MAX));
+	kbps >>= 10;
+	*tput = *tput ? (*tput * 7 + (u32)kbps) / 8 : (u32)kbps;
+}
+
+/*
+ * Packing is kept on only while packed writes are measured to be at least
+ * as fast as single ones. Every MMC_BLK_PACK_PROBE write requests it is
+ * tried anyway, so that the packed estimate follows the card.
+ */
+static bool mmc_blk_packing_pays_off(struct mmc_queue *mq)
+{
+	struct mmc_wr_pack_stats *stats = &mq->card->wr_pack_stats;
+
+	if (!stats->single_wr_tput || !stats->packed_wr_tput ||
+	    stats->packed_wr_tput >= stats->single_wr_tput)
+		return true;
+
+	if (++mq->wr_pack_probe < MMC_BLK_PACK_PROBE)
+		return false;
+	mq->wr_pack_probe = 0;
+	return true;
+}
+
+/*
+ * Max sectors in a write pack. Reads that arrive while a pack is on the
+ * bus wait for all of it, so when reads were seen recently a pack is cut
+ * at what the card is measured to write within wr_pack_budget_us.
+ * Returns 0 when there is no limit.
+ */
+static unsigned int mmc_blk_pack_budget_sectors(struct mmc_queue *mq)
+{
+	u32 tput = mq->card->wr_pack_stats.packed_wr_tput;
+	u64 sectors;
+
+	if (!mq->wr_pack_budget_us || !tput ||
+	    time_after_eq(jiffies, mq->last_rd_jiffies + MMC_BLK_MIXED_WINDOW))
+		return 0;
+
+	/* KB/s * usec / 10^6 = KB, two sectors each */
+	sectors = (u64)tput * mq->wr_pack_budget_us * 2;
+	do_div(sectors, USEC_PER_SEC);
+	return max_t(u32, sectors, 1);
+}
+
 static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 					  struct request *req)
 {
@@ -1528,6 +1643,7 @@ static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 	if (data_dir == READ) {
 		mq->num_of_potential_packed_wr_reqs = 0;
 		mq->wr_packing_enabled = false;
+		mq->last_rd_jiffies = jiffies;
 		return;
 	} else if (data_dir == WRITE) {
 		mq->num_of_potential_packed_wr_reqs++;
@@ -1535,7 +1651,7 @@ static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 
 	if (mq->num_of_potential_packed_wr_reqs >
 			mq->num_wr_reqs_to_start_packing)
-		mq->wr_packing_enabled = true;
+		mq->wr_packing_enabled = mmc_blk_packing_pays_off(mq);
 
 }
 
@@ -1621,6 +1737,14 @@ void print_mmc_packing_stats(struct mmc_card *card)
 		pr_info("%s: %d times: Threshold\n",
 			mmc_hostname(card->host),
 			card->wr_pack_stats.pack_stop_reason[THRESHOLD]);
+	if (card->wr_pack_stats.pack_stop_reason[LATENCY_BUDGET])
+		pr_info("%s: %d times: read latency budget\n",
+			mmc_hostname(card->host),
+			card->wr_pack_stats.pack_stop_reason[LATENCY_BUDGET]);
+
+	pr_info("%s: write throughput: single %u KB/s, packed %u KB/s\n",
+		mmc_hostname(card->host), card->wr_pack_stats.single_wr_tput,
+		card->wr_pack_stats.packed_wr_tput);
 
 	spin_unlock(&card->wr_pack_stats.lock);
 }
@@ -1634,7 +1758,7 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	struct mmc_blk_data *md = mq->data;
 	bool en_rel_wr = card->ext_csd.rel_param & EXT_CSD_WR_REL_PARAM_EN;
 	unsigned int req_sectors = 0, phys_segments = 0;
-	unsigned int max_blk_count, max_phys_segs;
+	unsigned int max_blk_count, max_phys_segs, budget_sectors;
 	u8 put_back = 0;
 	u8 max_packed_rw = 0;
 	u8 reqs = 0;
@@ -1668,6 +1792,7 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 		max_blk_count = 0xffff;
 
 	max_phys_segs = queue_max_segments(q);
+	budget_sectors = mmc_blk_pack_budget_sectors(mq);
 	req_sectors += blk_rq_sectors(cur);
 	phys_segments += cur->nr_phys_segments;
 
@@ -1716,6 +1841,12 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 			break;
 		}
 
+		if (budget_sectors && req_sectors > budget_sectors) {
+			MMC_BLK_UPDATE_STOP_REASON(stats, LATENCY_BUDGET);
+			put_back = 1;
+			break;
+		}
+
 		phys_segments +=  next->nr_phys_segments;
 		if (phys_segments > max_phys_segs) {
 			MMC_BLK_UPDATE_STOP_REASON(stats, EXCEEDS_SEGMENTS);
@@ -1829,6 +1960,7 @@ static void mmc_blk_packed_hdr_wrq_prep(struct mmc_queue_req *mqrq,
 	if (mq->packed_test_fn)
 		mq->packed_test_fn(mq->queue, mqrq);
 
+	mqrq->issue_time = ktime_get();
 	mmc_queue_bounce_pre(mqrq);
 }
 
@@ -1939,6 +2071,8 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		case MMC_BLK_SUCCESS:
 		case MMC_BLK_PARTIAL:
 			mmc_blk_reset_success(md, type);
+			if (status == MMC_BLK_SUCCESS)
+				mmc_blk_update_wr_tput(mq, mq_rq);
 
 			if (mq_rq->packed_cmd != MMC_PACKED_NONE) {
 				ret = mmc_blk_end_packed_req(mq, mq_rq);
@@ -2161,6 +2295,8 @@ static int sd_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		case MMC_BLK_SUCCESS:
 		case MMC_BLK_PARTIAL:
 			mmc_blk_reset_success(md, type);
+			if (status == MMC_BLK_SUCCESS)
+				mmc_blk_update_wr_tput(mq, mq_rq);
 
 			if (mq_rq->packed_cmd != MMC_PACKED_NONE) {
 				ret = mmc_blk_end_packed_req(mq, mq_rq);
@@ -2610,6 +2746,8 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 		card = md->queue.card;
 		device_remove_file(disk_to_dev(md->disk),
 				   &md->num_wr_reqs_to_start_packing);
+		device_remove_file(disk_to_dev(md->disk),
+				   &md->wr_pack_budget_us);
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
 			if ((md->area_type & MMC_BLK_DATA_AREA_BOOT) &&
@@ -2693,8 +2831,21 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	if (ret)
 		goto power_ro_lock_fail;
 
+	md->wr_pack_budget_us.show = wr_pack_budget_us_show;
+	md->wr_pack_budget_us.store = wr_pack_budget_us_store;
+	sysfs_attr_init(&md->wr_pack_budget_us.attr);
+	md->wr_pack_budget_us.attr.name = "wr_pack_budget_us";
+	md->wr_pack_budget_us.attr.mode = S_IRUGO | S_IWUSR;
+	ret = device_create_file(disk_to_dev(md->disk),
+				 &md->wr_pack_budget_us);
+	if (ret)
+		goto num_wr_reqs_fail;
+
 	return ret;
 
+num_wr_reqs_fail:
+		device_remove_file(disk_to_dev(md->disk),
+				   &md->num_wr_reqs_to_start_packing);
 power_ro_lock_fail:
 		device_remove_file(disk_to_dev(md->disk), &md->force_ro);
 force_ro_fail:
@@ -25,6 +25,7 @@
 #define MMC_QUEUE_SUSPENDED	(1 << 0)
 
 #define DEFAULT_NUM_REQS_TO_START_PACK 17
+#define DEFAULT_WR_PACK_BUDGET_US 10000
 
 static int mmc_prep_request(struct request_queue *q, struct request *req)
 {
@@ -224,6 +225,8 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	mq->mqrq_prev = mqrq_prev;
 	mq->queue->queuedata = mq;
 	mq->num_wr_reqs_to_start_packing = DEFAULT_NUM_REQS_TO_START_PACK;
+	mq->wr_pack_budget_us = DEFAULT_WR_PACK_BUDGET_US;
+	mq->last_rd_jiffies = jiffies - MMC_BLK_MIXED_WINDOW;
 
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
@@ -23,6 +23,9 @@ enum mmc_blk_status {
 	MMC_BLK_NOMEDIUM,
 };
 
+/* Write packs are bounded in time while reads were seen this recently */
+#define MMC_BLK_MIXED_WINDOW	(HZ / 10)
+
 enum mmc_packed_cmd {
 	MMC_PACKED_NONE = 0,
 	MMC_PACKED_WRITE,
@@ -42,6 +45,7 @@ struct mmc_queue_req {
 	enum mmc_packed_cmd	packed_cmd;
 	int		packed_fail_idx;
 	u8		packed_num;
+	ktime_t		issue_time;
 };
 
 struct mmc_queue {
@@ -58,6 +62,10 @@ struct mmc_queue {
 	bool			wr_packing_enabled;
 	int			num_of_potential_packed_wr_reqs;
 	int			num_wr_reqs_to_start_packing;
+	unsigned int		wr_pack_budget_us;
+	unsigned long		last_rd_jiffies;
+	int			wr_pack_probe;
+	ktime_t			last_done;
 	int (*err_check_fn) (struct mmc_card *, struct mmc_async_req *);
 	void (*packed_test_fn) (struct request_queue *, struct mmc_queue_req *);
 };
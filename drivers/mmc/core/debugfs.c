@@ -429,6 +429,19 @@ static ssize_t mmc_wr_pack_stats_read(struct file *filp, char __user *ubuf,
 			pack_stats->pack_stop_reason[THRESHOLD]);
 		strlcat(ubuf, temp_buf, cnt);
 	}
+	if (pack_stats->pack_stop_reason[LATENCY_BUDGET]) {
+		snprintf(temp_buf, TEMP_BUF_SIZE,
+			 "%s: %d times: read latency budget\n",
+			mmc_hostname(card->host),
+			pack_stats->pack_stop_reason[LATENCY_BUDGET]);
+		strlcat(ubuf, temp_buf, cnt);
+	}
+
+	snprintf(temp_buf, TEMP_BUF_SIZE,
+		 "%s: write throughput: single %u KB/s, packed %u KB/s\n",
+		 mmc_hostname(card->host), pack_stats->single_wr_tput,
+		 pack_stats->packed_wr_tput);
+	strlcat(ubuf, temp_buf, cnt);
 
 	spin_unlock(&pack_stats->lock);
 
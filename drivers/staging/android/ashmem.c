@@ -27,6 +27,8 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/moduleparam.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 #include <asm/cacheflush.h>
@@ -42,6 +44,7 @@ struct ashmem_area {
 	size_t size;			 
 	unsigned long vm_start;		 
 	unsigned long prot_mask;	 
+	struct mutex mutex;		/* protects the area and its ranges */
 };
 
 struct ashmem_range {
@@ -53,11 +56,25 @@ struct ashmem_range {
 	unsigned int purged;		
 };
 
+/*
+ * The LRU of unpinned ranges has its own lock, so that the shrinker does
+ * not have to wait for areas that are busy. Lock order: asma->mutex, then
+ * ashmem_lru_lock; the shrinker only ever trylocks an area.
+ */
 static LIST_HEAD(ashmem_lru_list);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
 
 static unsigned long lru_count;
+module_param_named(unpinned_pages, lru_count, ulong, S_IRUGO);
 
-static DEFINE_MUTEX(ashmem_mutex);
+static unsigned long lru_nr_ranges;
+
+static unsigned long ashmem_purged_pages;
+module_param_named(purged_pages, ashmem_purged_pages, ulong, S_IRUGO);
+
+/* ranges the shrinker passed over because their area was busy */
+static unsigned long ashmem_shrink_skips;
+module_param_named(shrink_skips, ashmem_shrink_skips, ulong, S_IRUGO);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -86,16 +103,27 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
+static inline void __lru_del(struct ashmem_range *range)
+{
+	list_del(&range->lru);
+	lru_count -= range_size(range);
+	lru_nr_ranges--;
+}
+
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	lru_nr_ranges++;
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
-	list_del(&range->lru);
-	lru_count -= range_size(range);
+	spin_lock(&ashmem_lru_lock);
+	__lru_del(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static int range_alloc(struct ashmem_area *asma,
@@ -138,11 +166,17 @@ static inline void range_shrink(struct ashmem_range *range,
 {
 	size_t pre = range_size(range);
 
+	if (!range_on_lru(range)) {
+		range->pgstart = start;
+		range->pgend = end;
+		return;
+	}
+
+	spin_lock(&ashmem_lru_lock);
 	range->pgstart = start;
 	range->pgend = end;
-
-	if (range_on_lru(range))
-		lru_count -= pre - range_size(range);
+	lru_count -= pre - range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -163,6 +197,7 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	}
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -175,10 +210,10 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -193,7 +228,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (asma->size == 0)
@@ -212,7 +247,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -221,7 +256,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -241,7 +276,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -257,7 +292,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely(!asma->size)) {
@@ -301,13 +336,23 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	asma->vm_start = vma->vm_start;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * Purge unpinned ranges, oldest first. An area that is busy (being pinned,
+ * unpinned or mapped, possibly by the task that is reclaiming right now)
+ * is not waited for: its ranges are moved to the tail of the LRU and the
+ * next ones are tried, so every call gets as far as it can.
+ */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
+	struct ashmem_area *asma;
+	unsigned long budget;
+	long nr_to_scan = sc->nr_to_scan;
+	int ret;
 
 	
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
@@ -315,26 +360,45 @@ static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (!sc->nr_to_scan)
 		return lru_count;
 
-	
-	if (!mutex_trylock(&ashmem_mutex)) {
-                return -1;
-	}
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	spin_lock(&ashmem_lru_lock);
+	budget = lru_nr_ranges;
+	while (budget-- && nr_to_scan > 0 && !list_empty(&ashmem_lru_list)) {
+		struct inode *inode;
+		loff_t start, end;
+		size_t size;
+
+		range = list_first_entry(&ashmem_lru_list, struct ashmem_range,
+					 lru);
+		asma = range->asma;
+
+		if (!mutex_trylock(&asma->mutex)) {
+			list_move_tail(&range->lru, &ashmem_lru_list);
+			ashmem_shrink_skips++;
+			continue;
+		}
+
+		/* The range cannot change or go away while we hold the area */
+		__lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+
+		inode = asma->file->f_dentry->d_inode;
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
+		size = range_size(range);
 
-		vmtruncate_range(inode, start, end);
 		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+		vmtruncate_range(inode, start, end);
+		mutex_unlock(&asma->mutex);
 
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+		nr_to_scan -= size;
+
+		spin_lock(&ashmem_lru_lock);
+		ashmem_purged_pages += size;
 	}
-	mutex_unlock(&ashmem_mutex);
+	ret = lru_count;
+	spin_unlock(&ashmem_lru_lock);
 
-	return lru_count;
+	return ret;
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -346,7 +410,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -361,7 +425,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -369,7 +433,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely(asma->file)) {
@@ -383,7 +447,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -392,7 +456,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -405,7 +469,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -523,7 +587,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -537,7 +601,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -648,10 +712,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	case ASHMEM_SET_SIZE:
 		ret = -EINVAL;
+		mutex_lock(&asma->mutex);
 		if (!asma->file) {
 			ret = 0;
 			asma->size = (size_t) arg;
 		}
+		mutex_unlock(&asma->mutex);
 		break;
 	case ASHMEM_GET_SIZE:
 		ret = asma->size;
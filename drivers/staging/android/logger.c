@@ -25,16 +25,24 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/mm.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * Writers do not take any lock: an entry is reserved by moving 'reserve'
+ * forward with cmpxchg, copied into the ring and then committed by moving
+ * 'w_off' past it, in reservation order. Readers only use entries below
+ * 'w_off'. Positions only ever grow; logger_offset() maps them into the
+ * buffer, and the log holds the entries in [head, w_off).
+ */
 struct logger_log {
 	unsigned char		*buffer;
 	struct miscdevice	misc;	
 	wait_queue_head_t	wq;	
-	struct list_head	readers; 
-	struct mutex		mutex;	
+	struct mutex		mutex;	/* serializes readers */
+	size_t			reserve;
 	size_t			w_off;	
 	size_t			head;	
 	size_t			size;	
@@ -42,17 +50,43 @@ struct logger_log {
 
 struct logger_reader {
 	struct logger_log	*log;	
-	struct list_head	list;	
 	size_t			r_off;	
 	bool			r_all;	
 	int			r_ver;	
 };
 
+/* Payloads up to this size are staged on the stack by writers */
+#define LOGGER_STAGE_SIZE	256
+
 size_t logger_offset(struct logger_log *log, size_t n)
 {
 	return n & (log->size-1);
 }
 
+/*
+ * A writer moves 'head' past the data it is about to overwrite before it
+ * copies anything, so a position that 'head' has gone past must not be
+ * trusted. Check this after reading from the ring, behind smp_rmb().
+ */
+static inline bool logger_pos_stale(struct logger_log *log, size_t pos)
+{
+	return pos - ACCESS_ONCE(log->head) > log->size;
+}
+
+static inline size_t logger_w_off(struct logger_log *log)
+{
+	size_t w_off = ACCESS_ONCE(log->w_off);
+
+	smp_rmb();
+	return w_off;
+}
+
+static inline void logger_sync_reader(struct logger_log *log,
+				      struct logger_reader *reader)
+{
+	if (logger_pos_stale(log, reader->r_off))
+		reader->r_off = ACCESS_ONCE(log->head);
+}
 
 static inline struct logger_log *file_get_log(struct file *file)
 {
@@ -63,27 +97,22 @@ static inline struct logger_log *file_get_log(struct file *file)
 		return file->private_data;
 }
 
+/*
+ * The entry may be overwritten while we look at it, so the header is
+ * always copied out and only trusted once the position is checked again.
+ */
 static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
+		size_t pos, struct logger_entry *scratch)
 {
+	size_t off = logger_offset(log, pos);
 	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
+
+	memcpy(((void *) scratch), log->buffer + off, len);
+	if (len != sizeof(struct logger_entry))
 		memcpy(((void *) scratch) + len, log->buffer,
 			sizeof(struct logger_entry) - len);
-		return scratch;
-	}
 
-	return (struct logger_entry *) (log->buffer + off);
-}
-
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
-{
-	struct logger_entry scratch;
-	struct logger_entry *entry;
-
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+	return scratch;
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -118,17 +147,19 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 	return copy_to_user(buf, hdr, hdr_len);
 }
 
+/*
+ * Returns 0 if a writer overwrote the entry while it was being copied;
+ * the reader must then start over from the new head.
+ */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
+				   struct logger_entry *entry,
 				   char __user *buf,
 				   size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
 	size_t len;
 	size_t msg_start;
 
-	entry = get_entry_header(log, reader->r_off, &scratch);
 	if (copy_header_to_user(reader->r_ver, entry, buf))
 		return -EFAULT;
 
@@ -145,8 +176,11 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
+	smp_rmb();
+	if (logger_pos_stale(log, reader->r_off))
+		return 0;
+
+	reader->r_off += sizeof(struct logger_entry) + count;
 
 	return count + get_user_hdr_len(reader->r_ver);
 }
@@ -154,23 +188,54 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 static size_t get_next_entry_by_uid(struct logger_log *log,
 		size_t off, uid_t euid)
 {
-	while (off != log->w_off) {
+	size_t w_off = logger_w_off(log);
+
+	while (off != w_off) {
 		struct logger_entry *entry;
 		struct logger_entry scratch;
-		size_t next_len;
 
 		entry = get_entry_header(log, off, &scratch);
 
+		smp_rmb();
+		if (logger_pos_stale(log, off)) {
+			off = ACCESS_ONCE(log->head);
+			continue;
+		}
+
 		if (entry->euid == euid)
 			return off;
 
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(log, off + next_len);
+		off += sizeof(struct logger_entry) + entry->len;
 	}
 
 	return off;
 }
 
+/*
+ * Reads the header of the entry at the reader's position, moving the
+ * reader to the head first if it was overrun. Returns false if there is
+ * no entry to read.
+ */
+static bool get_reader_entry(struct logger_log *log,
+			     struct logger_reader *reader,
+			     struct logger_entry *scratch)
+{
+	while (1) {
+		logger_sync_reader(log, reader);
+		if (!reader->r_all)
+			reader->r_off = get_next_entry_by_uid(log,
+				reader->r_off, current_euid());
+
+		if (logger_w_off(log) == reader->r_off)
+			return false;
+
+		get_entry_header(log, reader->r_off, scratch);
+		smp_rmb();
+		if (!logger_pos_stale(log, reader->r_off))
+			return true;
+	}
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -188,6 +253,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry scratch;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -197,7 +263,8 @@ start:
 
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		ret = (log->w_off == reader->r_off);
+		logger_sync_reader(log, reader);
+		ret = (logger_w_off(log) == reader->r_off);
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -221,26 +288,25 @@ start:
 
 	mutex_lock(&log->mutex);
 
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
 	
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(!get_reader_entry(log, reader, &scratch))) {
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + scratch.len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(log, reader, &scratch, buf, ret);
+	if (unlikely(!ret)) {
+		mutex_unlock(&log->mutex);
+		goto start;
+	}
 
 out:
 	mutex_unlock(&log->mutex);
@@ -248,89 +314,81 @@ out:
 	return ret;
 }
 
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+/*
+ * Move the head forward to at least @target, one entry at a time. The
+ * header at the old head may be overwritten under us by a writer that
+ * already moved the head past it, in which case the cmpxchg fails.
+ */
+static void logger_push_head(struct logger_log *log, size_t target)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(log, off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
+	struct logger_entry scratch;
+	size_t head, next;
 
-static inline int is_between(size_t a, size_t b, size_t c)
-{
-	if (a < b) {
-		
-		if (a < c && c <= b)
-			return 1;
-	} else {
-		
-		if (c <= b || a < c)
-			return 1;
+	while (1) {
+		head = ACCESS_ONCE(log->head);
+		if ((long)(target - head) <= 0)
+			break;
+		smp_rmb();
+		get_entry_header(log, head, &scratch);
+		next = head + sizeof(struct logger_entry) + scratch.len;
+		cmpxchg(&log->head, head, next);
 	}
 
-	return 0;
+	/* The head must be visible before the old data is overwritten */
+	smp_mb();
 }
 
-static void fix_up_readers(struct logger_log *log, size_t len)
+/*
+ * Reserve @len bytes for a new entry. The caller has preemption disabled
+ * until it commits, so at most one reservation per CPU is outstanding and
+ * the data between the head and the reservations is always committed.
+ */
+static size_t logger_reserve(struct logger_log *log, size_t len)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(log, old + len);
-	struct logger_reader *reader;
+	size_t pos;
+
+	do {
+		pos = ACCESS_ONCE(log->reserve);
+	} while (cmpxchg(&log->reserve, pos, pos + len) != pos);
 
-	if (is_between(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	logger_push_head(log, pos + len - log->size);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (is_between(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	return pos;
 }
 
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+/* Entries become visible to readers in the order they were reserved */
+static void logger_commit(struct logger_log *log, size_t pos, size_t len)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log, log->w_off + count);
+	while (ACCESS_ONCE(log->w_off) != pos)
+		cpu_relax();
 
+	smp_wmb();
+	ACCESS_ONCE(log->w_off) = pos + len;
 }
 
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void do_write_log(struct logger_log *log, size_t pos,
+			 const void *buf, size_t count)
 {
+	size_t off = logger_offset(log, pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
-	return count;
+		memcpy(log->buffer, buf + len, count - len);
 }
 
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	unsigned char stage[LOGGER_STAGE_SIZE];
+	unsigned char *msg = stage;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
+	size_t pos;
 
 	now = current_kernel_time();
 
@@ -346,36 +404,47 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	/*
+	 * Gather the payload before reserving: copying from user space may
+	 * fault, and nothing may sleep between reserve and commit.
+	 */
+	if (header.len > LOGGER_STAGE_SIZE) {
+		msg = kmalloc(header.len, GFP_KERNEL);
+		if (!msg)
+			return -ENOMEM;
+	}
 
-	while (nr_segs-- > 0) {
+	while (nr_segs-- > 0 && ret < header.len) {
 		size_t len;
-		ssize_t nr;
 
 		
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
-		
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (len && copy_from_user(msg + ret, iov->iov_base, len)) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
+	header.len = ret;
 
-	mutex_unlock(&log->mutex);
+	preempt_disable();
+	pos = logger_reserve(log, sizeof(struct logger_entry) + header.len);
+	do_write_log(log, pos, &header, sizeof(struct logger_entry));
+	do_write_log(log, pos + sizeof(struct logger_entry), msg, header.len);
+	logger_commit(log, pos, sizeof(struct logger_entry) + header.len);
+	preempt_enable();
 
-	
-	wake_up_interruptible(&log->wq);
+	/* Pairs with the barrier in prepare_to_wait() */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
+out:
+	if (msg != stage)
+		kfree(msg);
 	return ret;
 }
 
@@ -405,13 +474,7 @@ static int logger_open(struct inode *inode, struct file *file)
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
-
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		reader->r_off = ACCESS_ONCE(log->head);
 
 		file->private_data = reader;
 	} else
@@ -424,11 +487,6 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		struct logger_log *log = reader->log;
-
-		mutex_lock(&log->mutex);
-		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
 
 		kfree(reader);
 	}
@@ -451,17 +509,31 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
+	logger_sync_reader(log, reader);
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
 
-	if (log->w_off != reader->r_off)
+	if (logger_w_off(log) != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
+static long logger_get_position(struct logger_log *log, void __user *arg)
+{
+	struct logger_position position;
+
+	position.head = ACCESS_ONCE(log->head);
+	smp_rmb();
+	position.w_off = logger_w_off(log);
+
+	if (copy_to_user(arg, &position, sizeof(position)))
+		return -EFAULT;
+	return 0;
+}
+
 static long logger_set_version(struct logger_reader *reader, void __user *arg)
 {
 	int version;
@@ -475,10 +547,23 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 	return 0;
 }
 
+/* Drop everything committed so far; readers catch up lazily */
+static void logger_flush(struct logger_log *log)
+{
+	size_t head, w_off = logger_w_off(log);
+
+	do {
+		head = ACCESS_ONCE(log->head);
+		if ((long)(w_off - head) <= 0)
+			break;
+	} while (cmpxchg(&log->head, head, w_off) != head);
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_entry scratch;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
@@ -494,10 +579,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		logger_sync_reader(log, reader);
+		ret = logger_w_off(log) - reader->r_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -506,13 +589,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		reader = file->private_data;
 
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
-			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
+		if (get_reader_entry(log, reader, &scratch))
+			ret = get_user_hdr_len(reader->r_ver) + scratch.len;
 		else
 			ret = 0;
 		break;
@@ -521,9 +599,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		logger_flush(log);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -542,6 +618,13 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
+	case LOGGER_GET_POSITION:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		ret = logger_get_position(log, argp);
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -549,11 +632,44 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+/*
+ * Read-only view of the whole buffer, so that collectors can consume many
+ * entries per system call. Only for readers that may see every entry,
+ * since the mapping cannot filter by uid.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_reader *reader;
+	struct logger_log *log;
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	reader = file->private_data;
+	log = reader->log;
+
+	if (!reader->r_all)
+		return -EPERM;
+
+	if (vma->vm_pgoff || size > PAGE_ALIGN(log->size))
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(log->buffer) >> PAGE_SHIFT,
+			       size, vma->vm_page_prot);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -561,7 +677,7 @@ static const struct file_operations logger_fops = {
 };
 
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -571,8 +687,8 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.reserve = 0, \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
@@ -41,6 +41,18 @@ struct logger_entry {
 	char		msg[0];		
 };
 
+/*
+ * Positions in the log only ever grow (modulo 2^32); the entry at
+ * position p starts at offset p & (size - 1) of the buffer that a reader
+ * may mmap read-only. The log holds the entries in [head, w_off). Data
+ * copied out of the mapping is only valid if head has not moved past it
+ * by the time LOGGER_GET_POSITION is called again.
+ */
+struct logger_position {
+	__u32		head;
+	__u32		w_off;
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	
 #define LOGGER_LOG_EVENTS	"log_events"	
 #define LOGGER_LOG_SYSTEM	"log_system"	
@@ -56,5 +68,6 @@ struct logger_entry {
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) 
 #define LOGGER_GET_VERSION		_IO(__LOGGERIO, 5) 
 #define LOGGER_SET_VERSION		_IO(__LOGGERIO, 6) 
+#define LOGGER_GET_POSITION		_IOR(__LOGGERIO, 7, struct logger_position)
 
 #endif 
@@ -17,6 +17,13 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Writing 1 to /sys/module/lowmemorykiller/parameters/mode selects kills by
+ * reclaim pressure instead: the share of scanned pages that vmscan failed to
+ * reclaim over the last pressure_window scanned pages is compared against
+ * /sys/module/lowmemorykiller/parameters/pressure_level (percentages in
+ * descending order, one per adj entry).  More than pressure_allocstall direct
+ * reclaim stalls in a window raise the kill level by one step.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -36,7 +43,16 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/rcupdate.h>
+#include <linux/rculist_nulls.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/vmstat.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/lowmemorykiller.h>
+
+#define LOWMEM_MODE_MINFREE	0
+#define LOWMEM_MODE_PRESSURE	1
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -74,6 +90,28 @@ static size_t fork_boost_adj[6] = {
 	12
 };
 
+static uint32_t lowmem_mode = LOWMEM_MODE_MINFREE;
+static int lowmem_pressure_level[6] = {
+	95,
+	90,
+	80,
+	60,
+};
+static int lowmem_pressure_level_size = 4;
+static uint32_t lowmem_pressure_window = 512;
+static uint32_t lowmem_pressure_allocstall = 16;
+static uint32_t lowmem_kill_count;
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static unsigned long lowmem_last_scanned;
+static unsigned long lowmem_last_reclaimed;
+static unsigned long lowmem_last_allocstall;
+static unsigned long lowmem_last_sample;
+static int lowmem_pressure;
+static unsigned long lowmem_pressure_stalls;
+static unsigned long lowmem_pressure_expires;
+
+static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 static unsigned long lowmem_fork_boost_timeout;
 static uint32_t lowmem_fork_boost = 1;
@@ -99,6 +137,24 @@ task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data
 	return NOTIFY_OK;
 }
 
+static int
+task_free_notify_func(struct notifier_block *self, unsigned long val, void *data);
+
+static struct notifier_block task_free_nb = {
+	.notifier_call = task_free_notify_func,
+};
+
+static int
+task_free_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+
+	if (task == lowmem_deathpending)
+		lowmem_deathpending = NULL;
+
+	return NOTIFY_OK;
+}
+
 static void dump_tasks(void)
 {
 	struct task_struct *p;
@@ -119,13 +175,91 @@ static void dump_tasks(void)
 	}
 }
 
+static void lowmem_read_reclaim_events(unsigned long *scanned,
+				       unsigned long *reclaimed,
+				       unsigned long *allocstall)
+{
+	int cpu, i;
+
+	*scanned = *reclaimed = *allocstall = 0;
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (i = 0; i < MAX_NR_ZONES; i++) {
+			*scanned += this->event[PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL + i];
+			*scanned += this->event[PGSCAN_DIRECT_NORMAL - ZONE_NORMAL + i];
+			*reclaimed += this->event[PGSTEAL_KSWAPD_NORMAL - ZONE_NORMAL + i];
+			*reclaimed += this->event[PGSTEAL_DIRECT_NORMAL - ZONE_NORMAL + i];
+		}
+		*allocstall += this->event[ALLOCSTALL];
+	}
+}
+
+/*
+ * Sample reclaim efficiency once at least lowmem_pressure_window pages
+ * have been scanned since the previous sample.  A sample stays valid for
+ * a second; windows that take longer than that to fill are restarted so
+ * that old reclaim activity does not leak into the next sample.
+ */
+static int lowmem_update_pressure(unsigned long *stalls)
+{
+	unsigned long scanned, reclaimed, allocstall;
+	unsigned long delta_scanned, delta_reclaimed, delta_stalls;
+	int pressure;
+
+	lowmem_read_reclaim_events(&scanned, &reclaimed, &allocstall);
+
+	spin_lock(&lowmem_pressure_lock);
+	delta_scanned = scanned - lowmem_last_scanned;
+	if (delta_scanned < max_t(uint32_t, lowmem_pressure_window, 1)) {
+		if (time_after(jiffies, lowmem_last_sample + HZ))
+			goto restart;
+		goto out;
+	}
+
+	delta_reclaimed = min(reclaimed - lowmem_last_reclaimed, delta_scanned);
+	delta_stalls = allocstall - lowmem_last_allocstall;
+	pressure = 100 - delta_reclaimed * 100 / delta_scanned;
+
+	lowmem_pressure = pressure;
+	lowmem_pressure_stalls = delta_stalls;
+	lowmem_pressure_expires = jiffies + HZ;
+	trace_lowmem_pressure(delta_scanned, delta_reclaimed, delta_stalls,
+			      pressure);
+restart:
+	lowmem_last_scanned = scanned;
+	lowmem_last_reclaimed = reclaimed;
+	lowmem_last_allocstall = allocstall;
+	lowmem_last_sample = jiffies;
+out:
+	if (time_after(jiffies, lowmem_pressure_expires)) {
+		lowmem_pressure = 0;
+		lowmem_pressure_stalls = 0;
+	}
+	pressure = lowmem_pressure;
+	*stalls = lowmem_pressure_stalls;
+	spin_unlock(&lowmem_pressure_lock);
+
+	return pressure;
+}
+
+static void lowmem_reset_pressure(void)
+{
+	spin_lock(&lowmem_pressure_lock);
+	lowmem_pressure = 0;
+	lowmem_pressure_stalls = 0;
+	spin_unlock(&lowmem_pressure_lock);
+}
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *tsk;
+	struct hlist_nulls_node *node;
 	struct task_struct *selected = NULL;
 	int rem = 0;
 	int tasksize;
 	int i;
+	int bucket;
 	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_score_adj;
@@ -135,10 +269,28 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	int other_file = global_page_state(NR_FILE_PAGES) -
 		global_page_state(NR_SHMEM) - global_page_state(NR_MLOCK);
 	int fork_boost = 0;
+	int pressure = 0;
+	unsigned long stalls;
 	int *adj_array;
 	size_t *min_array;
 
-	if (lowmem_fork_boost &&
+	if (lowmem_mode == LOWMEM_MODE_PRESSURE) {
+		pressure = lowmem_update_pressure(&stalls);
+
+		if (lowmem_adj_size < array_size)
+			array_size = lowmem_adj_size;
+		if (lowmem_pressure_level_size < array_size)
+			array_size = lowmem_pressure_level_size;
+
+		for (i = 0; i < array_size; i++) {
+			if (pressure >= lowmem_pressure_level[i])
+				break;
+		}
+		if (stalls >= lowmem_pressure_allocstall && i > 0)
+			i--;
+		if (i < array_size)
+			min_score_adj = lowmem_adj[i];
+	} else if (lowmem_fork_boost &&
 		time_before_eq(jiffies, lowmem_fork_boost_timeout)) {
 		for (i = 0; i < lowmem_minfree_size; i++)
 			minfree_tmp[i] = lowmem_minfree[i] + lowmem_fork_boost_minfree[i];
@@ -151,24 +303,36 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		min_array = lowmem_minfree;
 	}
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-
-	for (i = 0; i < array_size; i++) {
-		if (other_free < min_array[i] &&
-		    other_file < min_array[i]) {
-			min_score_adj = adj_array[i];
-			fork_boost = lowmem_fork_boost_minfree[i];
-			break;
+	if (lowmem_mode != LOWMEM_MODE_PRESSURE) {
+		if (lowmem_adj_size < array_size)
+			array_size = lowmem_adj_size;
+		if (lowmem_minfree_size < array_size)
+			array_size = lowmem_minfree_size;
+
+		for (i = 0; i < array_size; i++) {
+			if (other_free < min_array[i] &&
+			    other_file < min_array[i]) {
+				min_score_adj = adj_array[i];
+				fork_boost = lowmem_fork_boost_minfree[i];
+				break;
+			}
 		}
 	}
 
+	/*
+	 * If we already have a death outstanding, then
+	 * bail out right away; indicating to vmscan
+	 * that we have nothing further to offer on
+	 * this pass.
+	 */
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+		return 0;
+
 	if (sc->nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
+		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, pressure %d, ma %d\n",
 				sc->nr_to_scan, sc->gfp_mask, other_free,
-				other_file, min_score_adj);
+				other_file, pressure, min_score_adj);
 	rem = global_page_state(NR_ACTIVE_ANON) +
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
@@ -180,48 +344,57 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_score_adj = min_score_adj;
 
+	/*
+	 * Thread group leaders are indexed by oom_score_adj, so only the
+	 * buckets at or above min_score_adj need to be looked at, starting
+	 * from the most killable one.  A task that is moving between
+	 * buckets may be seen in the wrong one, hence the recheck of
+	 * oom_score_adj below, and a walk that was carried into another
+	 * bucket by such a move is restarted.
+	 */
 	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_score_adj;
+	for (bucket = OOM_ADJ_INDEX_BUCKETS - 1;
+	     bucket >= oom_adj_index_bucket(min_score_adj) && !selected;
+	     bucket--) {
+restart:
+		hlist_nulls_for_each_entry_rcu(tsk, node,
+					       &oom_adj_index[bucket],
+					       oom_adj_node) {
+			struct task_struct *p;
+			int oom_score_adj;
 
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+			if (tsk->flags & PF_KTHREAD)
+				continue;
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
+			p = find_lock_task_mm(tsk);
+			if (!p)
+				continue;
 
-		if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
-		    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			lowmem_print(2, "%d (%s), oom_adj %d score_adj %d, is exiting, return\n"
-					, p->pid, p->comm, p->signal->oom_adj, p->signal->oom_score_adj);
-			task_unlock(p);
-			rcu_read_unlock();
-			return 0;
-		}
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
+			oom_score_adj = p->signal->oom_score_adj;
+			if (oom_score_adj < min_score_adj) {
+				task_unlock(p);
 				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(p->mm);
+			task_unlock(p);
+			if (tasksize <= 0)
 				continue;
+			if (selected) {
+				if (oom_score_adj < selected_oom_score_adj)
+					continue;
+				if (oom_score_adj == selected_oom_score_adj &&
+				    tasksize <= selected_tasksize)
+					continue;
+			}
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_score_adj = oom_score_adj;
+			selected_oom_adj = p->signal->oom_adj;
+			lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
+				     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		selected_oom_adj = p->signal->oom_adj;
-		lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
-			     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
+		if (get_nulls_value(node) != bucket)
+			goto restart;
 	}
 	if (selected) {
 		lowmem_print(1, "[%s] send sigkill to %d (%s), oom_adj %d, score_adj %d,"
@@ -230,13 +403,19 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     selected_oom_adj, selected_oom_score_adj,
 			     min_score_adj, selected_tasksize << 2,
 			     other_free << 2, other_file << 2, fork_boost << 2);
+		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		if (selected_oom_adj < 7)
 		{
 			dump_tasks();
 		}
+		trace_lowmem_kill(selected, selected_tasksize, min_score_adj,
+				  lowmem_mode, pressure);
 		send_sig(SIGKILL, selected, 0);
 		set_tsk_thread_flag(selected, TIF_MEMDIE);
+		lowmem_kill_count++;
+		if (lowmem_mode == LOWMEM_MODE_PRESSURE)
+			lowmem_reset_pressure();
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
@@ -253,6 +432,10 @@ static struct shrinker lowmem_shrinker = {
 static int __init lowmem_init(void)
 {
 	task_fork_register(&task_fork_nb);
+	task_free_register(&task_free_nb);
+	lowmem_read_reclaim_events(&lowmem_last_scanned, &lowmem_last_reclaimed,
+				   &lowmem_last_allocstall);
+	lowmem_last_sample = jiffies;
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -260,6 +443,7 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	task_free_unregister(&task_free_nb);
 	task_fork_unregister(&task_fork_nb);
 }
 
@@ -272,6 +456,14 @@ module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 module_param_named(fork_boost, lowmem_fork_boost, uint, S_IRUGO | S_IWUSR);
 module_param_array_named(fork_boost_minfree, lowmem_fork_boost_minfree, uint,
 			 &lowmem_fork_boost_minfree_size, S_IRUGO | S_IWUSR);
+module_param_named(mode, lowmem_mode, uint, S_IRUGO | S_IWUSR);
+module_param_array_named(pressure_level, lowmem_pressure_level, int,
+			 &lowmem_pressure_level_size, S_IRUGO | S_IWUSR);
+module_param_named(pressure_window, lowmem_pressure_window, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_allocstall, lowmem_pressure_allocstall, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(kill_count, lowmem_kill_count, uint, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,243 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/sched.h>
+#include <linux/err.h>
+#include <linux/string.h>
+
+#include "zcomp.h"
+
+/* Compressors offered through the comp_algorithm sysfs node */
+static const char * const backends[] = {
+	"lzo",
+	"lz4",
+	"deflate",
+	NULL
+};
+
+bool zcomp_available_algorithm(const char *comp)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!strcmp(comp, backends[i]))
+			return crypto_has_comp(comp, 0, 0);
+	}
+	return false;
+}
+
+/* Lists the compressors the crypto API can provide, current one in [] */
+ssize_t zcomp_available_show(const char *comp, char *buf)
+{
+	ssize_t sz = 0;
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!crypto_has_comp(backends[i], 0, 0))
+			continue;
+		if (!strcmp(comp, backends[i]))
+			sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2,
+					"[%s] ", backends[i]);
+		else
+			sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2,
+					"%s ", backends[i]);
+	}
+	sz += scnprintf(buf + sz, PAGE_SIZE - sz, "\n");
+	return sz;
+}
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	if (!IS_ERR_OR_NULL(zstrm->tfm))
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+/*
+ * Called from the I/O path, so do not recurse into the block layer
+ * while allocating. The transform itself is allocated by the crypto
+ * API with GFP_KERNEL; reclaim that ends up writing to this device runs
+ * with PF_MEMALLOC set and so cannot recurse into here.
+ */
+static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp, gfp_t flags)
+{
+	struct zcomp_strm *zstrm = kzalloc(sizeof(*zstrm), flags);
+
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(comp->name, 0, 0);
+	zstrm->buffer = (void *)__get_free_pages(flags | __GFP_ZERO, 1);
+	if (IS_ERR(zstrm->tfm) || !zstrm->buffer) {
+		zcomp_strm_free(zstrm);
+		return NULL;
+	}
+	return zstrm;
+}
+
+/*
+ * Get an idle stream, allocating a new one if fewer than max_strm exist.
+ * Otherwise (or if the allocation fails) sleep until one is released.
+ */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (1) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_entry(comp->idle_strm.next,
+					   struct zcomp_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&comp->strm_lock);
+			return zstrm;
+		}
+
+		if (comp->avail_strm >= comp->max_strm) {
+			comp->strm_waits++;
+			spin_unlock(&comp->strm_lock);
+			wait_event(comp->strm_wait,
+				   !list_empty(&comp->idle_strm));
+			continue;
+		}
+
+		comp->avail_strm++;
+		spin_unlock(&comp->strm_lock);
+
+		zstrm = zcomp_strm_alloc(comp, GFP_NOIO);
+		if (zstrm)
+			return zstrm;
+
+		spin_lock(&comp->strm_lock);
+		comp->avail_strm--;
+		comp->strm_waits++;
+		spin_unlock(&comp->strm_lock);
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+	}
+}
+
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm <= comp->max_strm) {
+		list_add(&zstrm->list, &comp->idle_strm);
+		spin_unlock(&comp->strm_lock);
+		wake_up(&comp->strm_wait);
+		return;
+	}
+
+	/* The pool has been shrunk, drop the surplus stream */
+	comp->avail_strm--;
+	spin_unlock(&comp->strm_lock);
+	zcomp_strm_free(zstrm);
+}
+
+int zcomp_set_max_streams(struct zcomp *comp, int num_strm)
+{
+	struct zcomp_strm *zstrm;
+	LIST_HEAD(surplus);
+
+	if (num_strm < 1)
+		return -EINVAL;
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = num_strm;
+	while (comp->avail_strm > comp->max_strm &&
+	       !list_empty(&comp->idle_strm)) {
+		list_move(comp->idle_strm.next, &surplus);
+		comp->avail_strm--;
+	}
+	spin_unlock(&comp->strm_lock);
+
+	while (!list_empty(&surplus)) {
+		zstrm = list_entry(surplus.next, struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+
+	/* Writers waiting for a stream may now allocate one */
+	wake_up_all(&comp->strm_wait);
+	return 0;
+}
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		   const unsigned char *src, size_t *dst_len)
+{
+	unsigned int len = PAGE_SIZE * 2;
+	int ret;
+
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE,
+				   zstrm->buffer, &len);
+	*dst_len = len;
+	return ret;
+}
+
+int zcomp_decompress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		     const unsigned char *src, size_t src_len,
+		     unsigned char *dst)
+{
+	unsigned int dst_len = PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_decompress(zstrm->tfm, src, src_len, dst, &dst_len);
+	if (!ret && dst_len != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				   struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+	kfree(comp);
+}
+
+/*
+ * One stream is allocated up front so that a device which has been
+ * initialized can always make forward progress.
+ */
+struct zcomp *zcomp_create(const char *compress, int max_strm)
+{
+	struct zcomp *comp;
+	struct zcomp_strm *zstrm;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	strlcpy(comp->name, compress, sizeof(comp->name));
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+	comp->max_strm = max(max_strm, 1);
+
+	zstrm = zcomp_strm_alloc(comp, GFP_KERNEL);
+	if (!zstrm) {
+		kfree(comp);
+		return NULL;
+	}
+	list_add(&zstrm->list, &comp->idle_strm);
+	comp->avail_strm = 1;
+	return comp;
+}
@@ -0,0 +1,61 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+/* Transform and output buffer of one in-flight (de)compression */
+struct zcomp_strm {
+	struct crypto_comp *tfm;
+	/* output buffer, two pages in case the data expands */
+	void *buffer;
+	struct list_head list;
+};
+
+/*
+ * Pool of compression streams. Streams are created on demand, up to
+ * max_strm of them; I/O beyond that waits for an idle stream.
+ */
+struct zcomp {
+	char name[CRYPTO_MAX_ALG_NAME];
+	spinlock_t strm_lock;	/* protects the fields below */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;		/* streams allocated */
+	int max_strm;
+	u64 strm_waits;		/* finds that had to wait for a stream */
+};
+
+extern bool zcomp_available_algorithm(const char *comp);
+extern ssize_t zcomp_available_show(const char *comp, char *buf);
+
+extern struct zcomp *zcomp_create(const char *comp, int max_strm);
+extern void zcomp_destroy(struct zcomp *comp);
+extern int zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+
+extern struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+extern void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+extern int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+			  const unsigned char *src, size_t *dst_len);
+extern int zcomp_decompress(struct zcomp *comp, struct zcomp_strm *zstrm,
+			    const unsigned char *src, size_t src_len,
+			    unsigned char *dst);
+
+#endif
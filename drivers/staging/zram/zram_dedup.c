@@ -0,0 +1,140 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+#include "zram_dedup.h"
+
+/* One bucket per this many pages of disk, with a floor of 256 buckets */
+#define DEDUP_PAGES_PER_BUCKET	16
+#define DEDUP_MIN_BUCKETS	256
+
+u32 zram_dedup_checksum(const void *buf, size_t len)
+{
+	return jhash(buf, len, 0);
+}
+
+static struct hlist_head *dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[checksum & (zram->dedup_buckets - 1)];
+}
+
+/*
+ * Look for a stored object with the same compressed contents and take a
+ * reference on it. Identical pages compress to identical output, so
+ * comparing the compressed data is enough.
+ */
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		const void *buf, size_t len, u32 checksum)
+{
+	struct zram_dedup_entry *entry;
+	struct hlist_node *pos;
+	unsigned char *cmem;
+	int match;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, dedup_bucket(zram, checksum), node) {
+		if (entry->checksum != checksum || entry->size != len)
+			continue;
+
+		cmem = zs_map_object(zram->mem_pool, entry->handle);
+		match = !memcmp(cmem + sizeof(struct zobj_header), buf, len);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+		if (match) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+/*
+ * Make a freshly stored object available for sharing. Two writers of
+ * the same data may race and both insert; that only costs the sharing
+ * between those two.
+ */
+struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+		void *handle, size_t len, u32 checksum)
+{
+	struct zram_dedup_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->size = len;
+	entry->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, dedup_bucket(zram, checksum));
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference, freeing the object with the last one. Returns true
+ * if the object was freed. May be called from atomic context through
+ * the swap slot free notifier.
+ */
+bool zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return false;
+	}
+	hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+	return true;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t buckets = num_pages / DEDUP_PAGES_PER_BUCKET;
+
+	if (buckets < DEDUP_MIN_BUCKETS)
+		buckets = DEDUP_MIN_BUCKETS;
+	buckets = rounddown_pow_of_two(buckets);
+
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_hash = vzalloc(buckets * sizeof(*zram->dedup_hash));
+	if (!zram->dedup_hash)
+		return -ENOMEM;
+	zram->dedup_buckets = buckets;
+
+	return 0;
+}
+
+/* All entries are gone by now, the table has been torn down */
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+	zram->dedup_buckets = 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/list.h>
+#include <linux/types.h>
+
+struct zram;
+
+/*
+ * A compressed object shared by every table entry flagged ZRAM_DEDUP
+ * whose handle points here.
+ */
+struct zram_dedup_entry {
+	struct hlist_node node;
+	void *handle;		/* zsmalloc handle of the object */
+	u32 checksum;		/* of the compressed data */
+	u16 size;
+	u32 refcount;		/* protected by zram->dedup_lock */
+};
+
+extern u32 zram_dedup_checksum(const void *buf, size_t len);
+extern struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		const void *buf, size_t len, u32 checksum);
+extern struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+		void *handle, size_t len, u32 checksum);
+extern bool zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry);
+
+extern int zram_dedup_init(struct zram *zram, size_t num_pages);
+extern void zram_dedup_fini(struct zram *zram);
+
+#endif
@@ -29,11 +29,14 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
+#include <linux/cpumask.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
+#include "zcomp.h"
+#include "zram_dedup.h"
 
 /* Globals */
 static int zram_major;
@@ -89,21 +92,82 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static int zram_get_age(struct zram *zram, u32 index)
+{
+	return zram->table[index].flags >> ZRAM_AGE_SHIFT;
+}
+
+static void zram_set_age(struct zram *zram, u32 index, int age)
+{
+	zram->table[index].flags &= BIT(ZRAM_AGE_SHIFT) - 1;
+	zram->table[index].flags |= age << ZRAM_AGE_SHIFT;
+}
+
+/*
+ * Called after every read, without zram->lock held. The flags are only
+ * changed under the lock held for writing, which is only taken here when
+ * the page has actually been aged.
+ */
+static void zram_reset_age(struct zram *zram, u32 index)
+{
+	int age;
+
+	down_read(&zram->lock);
+	age = zram_get_age(zram, index);
+	up_read(&zram->lock);
+	if (!age)
+		return;
+
+	down_write(&zram->lock);
+	zram_set_age(zram, index, 0);
+	up_write(&zram->lock);
+}
+
+static bool zram_slot_allocated(struct zram *zram, u32 index)
+{
+	return zram->table[index].handle ||
+		zram_test_flag(zram, index, ZRAM_SAME) ||
+		zram_test_flag(zram, index, ZRAM_WB);
+}
+
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned long len,
+			   unsigned long element)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos != len / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
+/* zsmalloc handle of a compressed object, shared or not */
+static void *zram_obj_handle(struct zram *zram, u32 index)
+{
+	struct zram_dedup_entry *entry;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		entry = zram->table[index].handle;
+		return entry->handle;
+	}
+	return zram->table[index].handle;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,22 +197,156 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long block = 0;
+
+	while (1) {
+		block = find_next_zero_bit(zram->bitmap, zram->nr_blocks, block);
+		if (block >= zram->nr_blocks)
+			return ULONG_MAX;
+		if (!test_and_set_bit(block, zram->bitmap))
+			return block;
+	}
+}
+
+static void zram_free_block(struct zram *zram, unsigned long block)
+{
+	clear_bit(block, zram->bitmap);
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int zram_bdev_rw_page(struct zram *zram, struct page *page,
+			     unsigned long block, int rw)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = block << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	if (!ret)
+		zram_stat64_inc(zram, rw == READ ? &zram->stats.bd_reads :
+				&zram->stats.bd_writes);
+	return ret;
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long block;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *w = container_of(work, struct zram_bdev_work,
+						work);
+
+	w->ret = zram_bdev_rw_page(w->zram, w->page, w->block, READ);
+}
+
+/*
+ * Bios submitted from within a make_request function are only issued
+ * once it returns, so waiting for one from zram's I/O path would
+ * deadlock. Hand the read to a worker in that case.
+ */
+static int zram_bdev_read(struct zram *zram, struct page *page,
+			  unsigned long block)
+{
+	struct zram_bdev_work w;
+
+	if (!current->bio_list)
+		return zram_bdev_rw_page(zram, page, block, READ);
+
+	w.zram = zram;
+	w.page = page;
+	w.block = block;
+	INIT_WORK_ONSTACK(&w.work, zram_bdev_read_work);
+	queue_work(system_unbound_wq, &w.work);
+	flush_work(&w.work);
+	destroy_work_on_stack(&w.work);
+
+	return w.ret;
+}
+
+/* Read a written back page into a buffer that need not be a page */
+static int zram_bdev_read_buf(struct zram *zram, unsigned long block,
+			      void *buf)
+{
+	struct page *page;
+	void *mem;
+	int ret;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = zram_bdev_read(zram, page, block);
+	if (!ret) {
+		mem = kmap_atomic(page);
+		memcpy(buf, mem, PAGE_SIZE);
+		kunmap_atomic(mem);
+	}
+	__free_page(page);
+
+	return ret;
+}
+#endif
+
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	void *handle = zram->table[index].handle;
 
-	if (unlikely(!handle)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_free_block(zram, zram->table[index].block);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(&zram->stats.pages_wb);
+		zram->table[index].block = 0;
+		return;
+	}
+#endif
+
+	/*
+	 * No memory is allocated for same filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		if (!zram->table[index].element)
 			zram_stat_dec(&zram->stats.pages_zero);
-		}
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(&zram->stats.pages_same);
+		zram->table[index].element = 0;
 		return;
 	}
 
+	if (unlikely(!handle))
+		return;
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		__free_page(handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
@@ -156,7 +354,14 @@ static void zram_free_page(struct zram *zram, size_t index)
 		goto out;
 	}
 
-	zs_free(zram->mem_pool, handle);
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		if (!zram_dedup_put(zram, handle))
+			zram_stat64_sub(zram, &zram->stats.dup_data_size,
+					zram->table[index].size);
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
 
 	if (zram->table[index].size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
@@ -170,13 +375,35 @@ out:
 	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+/*
+ * Free the slots queued by zram_slot_free_notify(). Called with
+ * zram->lock held for writing, before any write to the table, so a
+ * queued free can never drop data written after it.
+ */
+static void zram_free_pending(struct zram *zram)
+{
+	struct zram_slot_free *free_rq;
+
+	spin_lock(&zram->slot_free_lock);
+	while (zram->slot_free_rq) {
+		free_rq = zram->slot_free_rq;
+		zram->slot_free_rq = free_rq->next;
+		spin_unlock(&zram->slot_free_lock);
+		if (zram->table)
+			zram_free_page(zram, free_rq->index);
+		kfree(free_rq);
+		spin_lock(&zram->slot_free_lock);
+	}
+	spin_unlock(&zram->slot_free_lock);
+}
+
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
@@ -203,27 +430,58 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
-static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
-			  u32 index, int offset, struct bio *bio)
+static int zram_bvec_read(struct zram *zram, struct zcomp_strm *zstrm,
+			  struct bio_vec *bvec, u32 index, int offset,
+			  struct bio *bio)
 {
 	int ret;
-	size_t clen;
+	void *handle;
 	struct page *page;
 	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		handle_same_page(bvec, zram->table[index].element);
 		return 0;
 	}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		if (!is_partial_io(bvec)) {
+			ret = zram_bdev_read(zram, page,
+					     zram->table[index].block);
+		} else {
+			uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+			if (!uncmem)
+				return -ENOMEM;
+			ret = zram_bdev_read_buf(zram,
+					zram->table[index].block, uncmem);
+			if (!ret) {
+				user_mem = kmap_atomic(page);
+				memcpy(user_mem + bvec->bv_offset,
+				       uncmem + offset, bvec->bv_len);
+				kunmap_atomic(user_mem);
+			}
+			kfree(uncmem);
+		}
+		if (ret) {
+			pr_err("Backing device read failed! err=%d, page=%u\n",
+			       ret, index);
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+			return ret;
+		}
+		flush_dcache_page(page);
+		return 0;
+	}
+#endif
+
 	/* Requested page is not present in compressed area */
 	if (unlikely(!zram->table[index].handle)) {
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
-		handle_zero_page(bvec);
+		handle_same_page(bvec, 0);
 		return 0;
 	}
 
@@ -245,13 +503,12 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	user_mem = kmap_atomic(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+	handle = zram_obj_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    uncmem, &clen);
+	ret = zcomp_decompress(zram->comp, zstrm, cmem + sizeof(*zheader),
+			       zram->table[index].size, uncmem);
 
 	if (is_partial_io(bvec)) {
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
@@ -259,11 +516,11 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		kfree(uncmem);
 	}
 
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -274,35 +531,52 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	return 0;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+static int zram_read_before_write(struct zram *zram, struct zcomp_strm *zstrm,
+				  unsigned char *mem, u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
+	void *handle;
 	struct zobj_header *zheader;
 	unsigned char *cmem;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].handle) {
-		memset(mem, 0, PAGE_SIZE);
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_fill_page(mem, PAGE_SIZE, zram->table[index].element);
 		return 0;
 	}
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		ret = zram_bdev_read_buf(zram, zram->table[index].block, mem);
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, page=%u\n",
+			       ret, index);
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+		}
+		return ret;
+	}
+#endif
+
+	if (!zram->table[index].handle) {
+		memset(mem, 0, PAGE_SIZE);
+		return 0;
+	}
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].handle);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    mem, &clen);
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+	handle = zram_obj_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle);
+	ret = zcomp_decompress(zram->comp, zstrm, cmem + sizeof(*zheader),
+			       zram->table[index].size, mem);
+	zs_unmap_object(zram->mem_pool, handle);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -311,46 +585,192 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Age every stored page by one step; any access resets the age */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+	int age;
+
+	down_write(&zram->lock);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (!zram_slot_allocated(zram, index))
+			continue;
+		age = zram_get_age(zram, index);
+		if (age < ZRAM_AGE_MAX)
+			zram_set_age(zram, index, age + 1);
+	}
+	up_write(&zram->lock);
+}
+
+/*
+ * Move incompressible pages, or pages that have reached ZRAM_AGE_MAX
+ * when @idle is set, to the backing device. The page is copied out and
+ * written without holding zram->lock. ZRAM_UNDER_WB is dropped by any
+ * write or free of the slot meanwhile, in which case the block is given
+ * back and the slot left alone.
+ */
+int zram_writeback(struct zram *zram, bool idle)
+{
+	size_t index;
+	unsigned long block = ULONG_MAX;
+	struct zcomp_strm *zstrm;
+	struct page *page;
+	int ret = 0;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (block == ULONG_MAX) {
+			block = zram_alloc_block(zram);
+			if (block == ULONG_MAX) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		zstrm = zcomp_strm_find(zram->comp);
+		down_write(&zram->lock);
+		zram_free_pending(zram);
+		if (!zram->table[index].handle ||
+		    zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB) ||
+		    (idle && zram_get_age(zram, index) < ZRAM_AGE_MAX) ||
+		    (!idle && !zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+			up_write(&zram->lock);
+			zcomp_strm_release(zram->comp, zstrm);
+			continue;
+		}
+		ret = zram_read_before_write(zram, zstrm, page_address(page),
+					     index);
+		if (!ret)
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		up_write(&zram->lock);
+		zcomp_strm_release(zram->comp, zstrm);
+		if (ret)
+			break;
+
+		ret = zram_bdev_rw_page(zram, page, block, WRITE);
+
+		down_write(&zram->lock);
+		if (!zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			up_write(&zram->lock);
+			if (ret)
+				break;
+			continue;
+		}
+		if (ret) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			up_write(&zram->lock);
+			break;
+		}
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].block = block;
+		zram_stat_inc(&zram->stats.pages_wb);
+		up_write(&zram->lock);
+		block = ULONG_MAX;
+
+		cond_resched();
+	}
+
+	if (block != ULONG_MAX)
+		zram_free_block(zram, block);
+	__free_page(page);
+	return ret;
+}
+
+static void zram_close_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->bitmap);
+	kfree(zram->backing_dev);
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->backing_dev = NULL;
+	zram->nr_blocks = 0;
+}
+
+/* Called with init_lock held for writing, before the device is set up */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_blocks;
+	unsigned long *bitmap;
+	char *name;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	name = kstrdup(path, GFP_KERNEL);
+	if (!nr_blocks || !bitmap || !name) {
+		vfree(bitmap);
+		kfree(name);
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		return nr_blocks ? -ENOMEM : -EINVAL;
+	}
+
+	zram_close_backing_dev(zram);
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_blocks;
+	zram->backing_dev = name;
+	pr_info("setup backing device %s, %lu pages\n", name, nr_blocks);
+
+	return 0;
+}
+#endif
+
+/*
+ * Only the table update runs under zram->lock; compression uses a stream
+ * from the per-device pool so that writes to different pages proceed in
+ * parallel.
+ */
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
 	size_t clen;
 	void *handle;
+	u32 checksum = 0;
+	unsigned long element;
+	bool dedup_hit = false;
 	struct zobj_header *zheader;
-	struct page *page, *page_store;
+	struct page *page, *page_store = NULL;
+	struct zram_dedup_entry *entry = NULL;
+	struct zcomp_strm *zstrm;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
+	zstrm = zcomp_strm_find(zram->comp);
 
 	if (is_partial_io(bvec)) {
 		/*
 		 * This is a partial IO. We need to read the full page
 		 * before to write the changes.
 		 */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			ret = -ENOMEM;
 			goto out;
 		}
-		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
+		down_read(&zram->lock);
+		ret = zram_read_before_write(zram, zstrm, uncmem, index);
+		up_read(&zram->lock);
+		if (ret)
 			goto out;
-		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
 	user_mem = kmap_atomic(page);
 
 	if (is_partial_io(bvec))
@@ -359,24 +779,30 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	else
 		uncmem = user_mem;
 
-	if (page_zero_filled(uncmem)) {
+	if (page_same_filled(uncmem, &element)) {
 		kunmap_atomic(user_mem);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
-		zram_stat_inc(&zram->stats.pages_zero);
-		zram_set_flag(zram, index, ZRAM_ZERO);
+		zcomp_strm_release(zram->comp, zstrm);
+		zstrm = NULL;
+
+		down_write(&zram->lock);
+		zram_free_pending(zram);
+		if (zram_slot_allocated(zram, index))
+			zram_free_page(zram, index);
+		zram_set_age(zram, index, 0);
+		if (!element)
+			zram_stat_inc(&zram->stats.pages_zero);
+		zram_stat_inc(&zram->stats.pages_same);
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = element;
+		up_write(&zram->lock);
 		ret = 0;
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
-
+	ret = zcomp_compress(zram->comp, zstrm, uncmem, &clen);
 	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
@@ -396,43 +822,67 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
 		handle = page_store;
-		src = kmap_atomic(page);
 		cmem = kmap_atomic(page_store);
-		goto memstore;
-	}
-
-	handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader));
-	if (!handle) {
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
-		ret = -ENOMEM;
-		goto out;
+		if (is_partial_io(bvec)) {
+			memcpy(cmem, uncmem, PAGE_SIZE);
+		} else {
+			src = kmap_atomic(page);
+			memcpy(cmem, src, PAGE_SIZE);
+			kunmap_atomic(src);
+		}
+		kunmap_atomic(cmem);
+	} else {
+		if (zram->use_dedup) {
+			checksum = zram_dedup_checksum(zstrm->buffer, clen);
+			entry = zram_dedup_find(zram, zstrm->buffer, clen,
+						checksum);
+			dedup_hit = entry != NULL;
+		}
+		if (!dedup_hit) {
+			handle = zs_malloc(zram->mem_pool,
+					   clen + sizeof(*zheader));
+			if (!handle) {
+				pr_info("Error allocating memory for compressed "
+					"page: %u, size=%zu\n", index, clen);
+				ret = -ENOMEM;
+				goto out;
+			}
+			cmem = zs_map_object(zram->mem_pool, handle);
+			memcpy(cmem, zstrm->buffer, clen);
+			zs_unmap_object(zram->mem_pool, handle);
+
+			if (zram->use_dedup)
+				entry = zram_dedup_insert(zram, handle, clen,
+							  checksum);
+		}
+		if (entry)
+			handle = entry;
 	}
-	cmem = zs_map_object(zram->mem_pool, handle);
 
-memstore:
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
+	zcomp_strm_release(zram->comp, zstrm);
+	zstrm = NULL;
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 
-	memcpy(cmem, src, clen);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	down_write(&zram->lock);
+	zram_free_pending(zram);
+	if (zram_slot_allocated(zram, index))
+		zram_free_page(zram, index);
+	zram_set_age(zram, index, 0);
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		kunmap_atomic(cmem);
-		kunmap_atomic(src);
-	} else {
-		zs_unmap_object(zram->mem_pool, handle);
+	if (page_store) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
 	}
-
+	if (entry)
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	if (dedup_hit)
+		zram_stat64_add(zram, &zram->stats.dup_data_size, clen);
 	zram->table[index].handle = handle;
 	zram->table[index].size = clen;
 
@@ -441,10 +891,15 @@ memstore:
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
+	up_write(&zram->lock);
 
 	return 0;
 
 out:
+	if (zstrm)
+		zcomp_strm_release(zram->comp, zstrm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
@@ -454,15 +909,22 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
 	int ret;
+	struct zcomp_strm *zstrm;
 
 	if (rw == READ) {
+		/*
+		 * Decompression also needs a stream. Take it before
+		 * zram->lock: writers hold a stream while they wait for
+		 * the lock.
+		 */
+		zstrm = zcomp_strm_find(zram->comp);
 		down_read(&zram->lock);
-		ret = zram_bvec_read(zram, bvec, index, offset, bio);
+		ret = zram_bvec_read(zram, zstrm, bvec, index, offset, bio);
 		up_read(&zram->lock);
+		zcomp_strm_release(zram->comp, zstrm);
+		zram_reset_age(zram, index);
 	} else {
-		down_write(&zram->lock);
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
 	}
 
 	return ret;
@@ -583,27 +1045,37 @@ void __zram_reset_device(struct zram *zram)
 
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	/* Slots freed by swap in the meantime */
+	down_write(&zram->lock);
+	zram_free_pending(zram);
+	up_write(&zram->lock);
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
 		void *handle = zram->table[index].handle;
-		if (!handle)
+		if (!handle || zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
 			__free_page(handle);
+		else if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, handle);
 		else
 			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
+	zram_dedup_fini(zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_close_backing_dev(zram);
+#endif
 
 	zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
@@ -635,17 +1107,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error allocating compression streams\n");
 		ret = -ENOMEM;
 		goto fail_no_table;
 	}
@@ -670,6 +1134,12 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	if (zram->use_dedup && zram_dedup_init(zram, num_pages)) {
+		pr_err("Error allocating dedup hash table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
 	zram->init_done = 1;
 	up_write(&zram->init_lock);
 
@@ -686,13 +1156,40 @@ fail:
 	return ret;
 }
 
+static void zram_slot_free_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, free_work);
+
+	down_read(&zram->init_lock);
+	down_write(&zram->lock);
+	zram_free_pending(zram);
+	up_write(&zram->lock);
+	up_read(&zram->init_lock);
+}
+
+/*
+ * Called by swap with swap_lock held, so zram->lock cannot be taken here.
+ * The slot is queued and freed under the lock, either by the next write
+ * or by free_work. If the request cannot be allocated the slot stays in
+ * use until it is overwritten.
+ */
 static void zram_slot_free_notify(struct block_device *bdev,
 				unsigned long index)
 {
 	struct zram *zram;
+	struct zram_slot_free *free_rq;
 
 	zram = bdev->bd_disk->private_data;
-	zram_free_page(zram, index);
+	free_rq = kmalloc(sizeof(*free_rq), GFP_ATOMIC);
+	if (!free_rq)
+		return;
+
+	free_rq->index = index;
+	spin_lock(&zram->slot_free_lock);
+	free_rq->next = zram->slot_free_rq;
+	zram->slot_free_rq = free_rq;
+	spin_unlock(&zram->slot_free_lock);
+	schedule_work(&zram->free_work);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -708,6 +1205,11 @@ static int create_device(struct zram *zram, int device_id)
 	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->slot_free_lock);
+	INIT_WORK(&zram->free_work, zram_slot_free_work);
+	zram->max_comp_streams = num_online_cpus();
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -842,8 +1344,12 @@ static void __exit zram_exit(void)
 		zram = &zram_devices[i];
 
 		destroy_device(zram);
+		flush_work(&zram->free_work);
 		if (zram->init_done)
 			zram_reset_device(zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+		zram_close_backing_dev(zram);
+#endif
 	}
 
 	unregister_blkdev(zram_major, "zram");
@@ -17,6 +17,8 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/crypto.h>
+#include <linux/workqueue.h>
 
 #include "../zsmalloc/zsmalloc.h"
 
@@ -40,6 +42,9 @@ struct zobj_header {
 
 /*-- Configurable parameters */
 
+/* Compressor used unless comp_algorithm is set before init */
+static const char default_compressor[] = "lzo";
+
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
@@ -71,22 +76,48 @@ enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page is filled with one repeated word, kept in table.element */
+	ZRAM_SAME,
+
+	/* table.handle points to a shared struct zram_dedup_entry */
+	ZRAM_DEDUP,
+
+	/* Page lives on the backing device at table.block */
+	ZRAM_WB,
+
+	/* Page is being written back; cleared if the slot changes */
+	ZRAM_UNDER_WB,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+/*
+ * The top bits of table.flags count how many times the page has been
+ * marked idle (through the 'idle' sysfs node) without being accessed.
+ */
+#define ZRAM_AGE_SHIFT	5
+#define ZRAM_AGE_MAX	((1 << (8 - ZRAM_AGE_SHIFT)) - 1)
+
 /*-- Data structures */
 
 /* Allocated for each disk page */
 struct table {
-	void *handle;
+	union {
+		void *handle;
+		unsigned long element;	/* fill pattern of ZRAM_SAME page */
+		unsigned long block;	/* backing device block of ZRAM_WB */
+	};
 	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/* A slot freed by swap, see zram_slot_free_notify() */
+struct zram_slot_free {
+	unsigned long index;
+	struct zram_slot_free *next;
+};
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -95,20 +126,29 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 dup_data_size;	/* compressed bytes shared by dedup */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of same filled pages, incl. zero */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* pages read back from backing device */
+	u64 bd_writes;		/* pages written to backing device */
+#endif
 };
 
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct rw_semaphore lock; /* protect table against concurrent
+				   * read and writes */
+	spinlock_t slot_free_lock;	/* protects slot_free_rq */
+	struct zram_slot_free *slot_free_rq;
+	struct work_struct free_work;	/* frees slot_free_rq */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,6 +159,22 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	int max_comp_streams;
+	char compressor[CRYPTO_MAX_ALG_NAME];
+
+	/* Sharing of identical compressed objects, see zram_dedup.c */
+	bool use_dedup;
+	spinlock_t dedup_lock;
+	struct hlist_head *dedup_hash;
+	size_t dedup_buckets;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device for incompressible and idle pages */
+	struct block_device *bdev;
+	char *backing_dev;
+	unsigned long *bitmap;	/* blocks in use on bdev */
+	unsigned long nr_blocks;
+#endif
 
 	struct zram_stats stats;
 };
@@ -132,4 +188,10 @@ extern struct attribute_group zram_disk_attr_group;
 extern int zram_init_device(struct zram *zram);
 extern void __zram_reset_device(struct zram *zram);
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, bool idle);
+#endif
+
 #endif
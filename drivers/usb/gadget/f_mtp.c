@@ -28,6 +28,7 @@
 
 #include <linux/types.h>
 #include <linux/file.h>
+#include <linux/backing-dev.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
 
@@ -51,9 +52,30 @@
 
 /* number of tx and rx requests to allocate */
 #define TX_REQ_MAX 4
-#define RX_REQ_MAX 2
+#define RX_REQ_MAX 8
 #define INTR_REQ_MAX 5
 
+/* upper bounds for the tunables below */
+#define TX_REQ_LIMIT 32
+#define MTP_BULK_BUFFER_MAX (1024 * 1024)
+
+/*
+ * Bulk request sizes and counts. Bigger requests mean fewer vfs calls and
+ * USB completions per file; if they cannot be allocated the driver falls
+ * back to MTP_BULK_BUFFER_SIZE. Sizes are rounded down to whole pages, so
+ * that every request but a file's last one is a multiple of maxpacket.
+ * Take effect on the next bind.
+ */
+static unsigned int mtp_tx_req_len = MTP_BULK_BUFFER_SIZE;
+module_param(mtp_tx_req_len, uint, S_IRUGO | S_IWUSR);
+static unsigned int mtp_rx_req_len = MTP_BULK_BUFFER_SIZE;
+module_param(mtp_rx_req_len, uint, S_IRUGO | S_IWUSR);
+static unsigned int mtp_tx_reqs = TX_REQ_MAX;
+module_param(mtp_tx_reqs, uint, S_IRUGO | S_IWUSR);
+/* at least 2, so that USB reads overlap with writes to the file */
+static unsigned int mtp_rx_reqs = 2;
+module_param(mtp_rx_reqs, uint, S_IRUGO | S_IWUSR);
+
 /* ID for Microsoft MTP OS String */
 #define MTP_OS_STRING_ID   0xEE
 
@@ -92,7 +114,11 @@ struct mtp_dev {
 	wait_queue_head_t write_wq;
 	wait_queue_head_t intr_wq;
 	struct usb_request *rx_req[RX_REQ_MAX];
-	int rx_done;
+	/* bumped by every rx completion, they complete in queue order */
+	unsigned rx_done;
+	unsigned rx_reqs;
+	unsigned tx_req_len;
+	unsigned rx_req_len;
 
 	/* for processing MTP_SEND_FILE, MTP_RECEIVE_FILE and
 	 * MTP_SEND_FILE_WITH_HEADER ioctls on a work queue
@@ -361,7 +387,7 @@ static void mtp_complete_out(struct usb_ep *ep, struct usb_request *req)
 {
 	struct mtp_dev *dev = _mtp_dev;
 
-	dev->rx_done = 1;
+	dev->rx_done++;
 	if (req->status != 0)
 		dev->state = STATE_ERROR;
 
@@ -380,6 +406,12 @@ static void mtp_complete_intr(struct usb_ep *ep, struct usb_request *req)
 	wake_up(&dev->intr_wq);
 }
 
+static unsigned mtp_bulk_req_len(unsigned len)
+{
+	len = min(len, (unsigned)MTP_BULK_BUFFER_MAX) & PAGE_MASK;
+	return max(len, (unsigned)MTP_BULK_BUFFER_SIZE);
+}
+
 static int mtp_create_bulk_endpoints(struct mtp_dev *dev,
 				struct usb_endpoint_descriptor *in_desc,
 				struct usb_endpoint_descriptor *out_desc,
@@ -420,17 +452,36 @@ static int mtp_create_bulk_endpoints(struct mtp_dev *dev,
 	dev->ep_intr = ep;
 
 	/* now allocate requests for our endpoints */
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_in, MTP_BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+	dev->tx_req_len = mtp_bulk_req_len(mtp_tx_req_len);
+retry_tx_alloc:
+	for (i = 0; i < clamp(mtp_tx_reqs, 2U, (unsigned)TX_REQ_LIMIT); i++) {
+		req = mtp_request_new(dev->ep_in, dev->tx_req_len);
+		if (!req) {
+			if (dev->tx_req_len == MTP_BULK_BUFFER_SIZE)
+				goto fail;
+			while ((req = mtp_req_get(dev, &dev->tx_idle)))
+				mtp_request_free(req, dev->ep_in);
+			dev->tx_req_len = MTP_BULK_BUFFER_SIZE;
+			goto retry_tx_alloc;
+		}
 		req->complete = mtp_complete_in;
 		mtp_req_put(dev, &dev->tx_idle, req);
 	}
-	for (i = 0; i < RX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_out, MTP_BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+	dev->rx_req_len = mtp_bulk_req_len(mtp_rx_req_len);
+	dev->rx_reqs = clamp(mtp_rx_reqs, 2U, (unsigned)RX_REQ_MAX);
+retry_rx_alloc:
+	for (i = 0; i < dev->rx_reqs; i++) {
+		req = mtp_request_new(dev->ep_out, dev->rx_req_len);
+		if (!req) {
+			if (dev->rx_req_len == MTP_BULK_BUFFER_SIZE)
+				goto fail;
+			while (i--) {
+				mtp_request_free(dev->rx_req[i], dev->ep_out);
+				dev->rx_req[i] = NULL;
+			}
+			dev->rx_req_len = MTP_BULK_BUFFER_SIZE;
+			goto retry_rx_alloc;
+		}
 		req->complete = mtp_complete_out;
 		dev->rx_req[i] = req;
 	}
@@ -460,7 +511,7 @@ static ssize_t mtp_read(struct file *fp, char __user *buf,
 
 	DBG(cdev, "mtp_read(%d)\n", count);
 
-	if (count > MTP_BULK_BUFFER_SIZE)
+	if (count > dev->rx_req_len)
 		return -EINVAL;
 
 	/* we will block until we're online */
@@ -589,8 +640,8 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 			break;
 		}
 
-		if (count > MTP_BULK_BUFFER_SIZE)
-			xfer = MTP_BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 		if (xfer && copy_from_user(req->buf, buf, xfer)) {
@@ -663,6 +714,16 @@ static void send_file_work(struct work_struct *data)
 	if ((count & (dev->ep_in->maxpacket - 1)) == 0)
 		sendZLP = 1;
 
+	/*
+	 * The file is read front to back, and the vfs_read() of one request
+	 * overlaps with the USB transfer of the others; let readahead keep
+	 * ahead of it as for POSIX_FADV_SEQUENTIAL.
+	 */
+	spin_lock(&filp->f_lock);
+	filp->f_ra.ra_pages = filp->f_mapping->backing_dev_info->ra_pages * 2;
+	filp->f_mode &= ~FMODE_RANDOM;
+	spin_unlock(&filp->f_lock);
+
 	while (count > 0 || sendZLP) {
 		/* so we exit after sending ZLP */
 		if (count == 0)
@@ -682,8 +743,8 @@ static void send_file_work(struct work_struct *data)
 			break;
 		}
 
-		if (count > MTP_BULK_BUFFER_SIZE)
-			xfer = MTP_BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 
@@ -731,17 +792,35 @@ static void send_file_work(struct work_struct *data)
 	smp_wmb();
 }
 
-/* read from USB and write to a local file */
+/* cancel the reads still queued by receive_file_work() */
+static void mtp_rx_dequeue(struct mtp_dev *dev, int head, int inflight)
+{
+	while (inflight--) {
+		usb_ep_dequeue(dev->ep_out, dev->rx_req[head]);
+		head = (head + 1) % dev->rx_reqs;
+	}
+}
+
+/*
+ * read from USB and write to a local file
+ *
+ * Up to rx_reqs - 1 reads are kept queued on ep_out while the data of the
+ * one that completed last is written to the file. When the length is not
+ * known up front (0xFFFFFFFF, the transfer ends with a short packet) only
+ * one read is queued at a time, so that none is left queued past the end
+ * of the data.
+ */
 static void receive_file_work(struct work_struct *data)
 {
 	struct mtp_dev *dev = container_of(data, struct mtp_dev,
 						receive_file_work);
 	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *read_req = NULL, *write_req = NULL;
+	struct usb_request *read_req, *write_req = NULL;
 	struct file *filp;
 	loff_t offset;
-	int64_t count;
-	int ret, cur_buf = 0;
+	int64_t count, to_queue;
+	int ret, head = 0, inflight = 0, max_inflight;
+	unsigned queued = 0;
 	int r = 0;
 
 	/* read our parameters */
@@ -752,22 +831,26 @@ static void receive_file_work(struct work_struct *data)
 
 	DBG(cdev, "receive_file_work(%lld)\n", count);
 
+	to_queue = count;
+	max_inflight = count == 0xFFFFFFFF ? 1 : dev->rx_reqs - 1;
+	dev->rx_done = 0;
 	while (count > 0 || write_req) {
-		if (count > 0) {
-			/* queue a request */
-			read_req = dev->rx_req[cur_buf];
-			cur_buf = (cur_buf + 1) % RX_REQ_MAX;
-
-			read_req->length = (count > MTP_BULK_BUFFER_SIZE
-					? MTP_BULK_BUFFER_SIZE : count);
-			dev->rx_done = 0;
+		/* keep ep_out busy while we write to the file */
+		while (to_queue > 0 && inflight < max_inflight) {
+			read_req = dev->rx_req[(head + inflight) % dev->rx_reqs];
+			read_req->length = (to_queue > dev->rx_req_len
+					? dev->rx_req_len : to_queue);
 			ret = usb_ep_queue(dev->ep_out, read_req, GFP_KERNEL);
 			if (ret < 0) {
 				r = -EIO;
 				if (dev->state != STATE_OFFLINE)
 					dev->state = STATE_ERROR;
-				break;
+				goto out;
 			}
+			if (count != 0xFFFFFFFF)
+				to_queue -= read_req->length;
+			inflight++;
+			queued++;
 		}
 
 		if (write_req) {
@@ -779,20 +862,25 @@ static void receive_file_work(struct work_struct *data)
 				r = -EIO;
 				if (dev->state != STATE_OFFLINE)
 					dev->state = STATE_ERROR;
-				break;
+				goto out;
 			}
 			write_req = NULL;
 		}
 
-		if (read_req) {
-			/* wait for our last read to complete */
+		if (count > 0 && inflight) {
+			read_req = dev->rx_req[head];
+			/* wait for the oldest read to complete */
 			ret = wait_event_interruptible(dev->read_wq,
-				dev->rx_done || dev->state != STATE_BUSY);
+				dev->rx_done != queued - inflight ||
+				dev->state != STATE_BUSY);
 			if (dev->state == STATE_CANCELED) {
 				r = -ECANCELED;
-				if (!dev->rx_done)
-					usb_ep_dequeue(dev->ep_out, read_req);
-				break;
+				goto out;
+			}
+			if (dev->rx_done == queued - inflight) {
+				/* interrupted, or an error from another path */
+				r = ret < 0 ? ret : -EIO;
+				goto out;
 			}
 			/* if xfer_file_length is 0xFFFFFFFF, then we read until
 			 * we get a zero length packet
@@ -806,13 +894,18 @@ static void receive_file_work(struct work_struct *data)
 				 */
 				DBG(cdev, "got short packet\n");
 				count = 0;
+				to_queue = 0;
 			}
 
+			head = (head + 1) % dev->rx_reqs;
+			inflight--;
 			write_req = read_req;
-			read_req = NULL;
 		}
 	}
 
+out:
+	if (inflight)
+		mtp_rx_dequeue(dev, head, inflight);
 	DBG(cdev, "receive_file_work returning %d\n", r);
 	/* write the result */
 	dev->xfer_result = r;
@@ -1128,8 +1221,10 @@ mtp_function_unbind(struct usb_configuration *c, struct usb_function *f)
 
 	while ((req = mtp_req_get(dev, &dev->tx_idle)))
 		mtp_request_free(req, dev->ep_in);
-	for (i = 0; i < RX_REQ_MAX; i++)
+	for (i = 0; i < RX_REQ_MAX; i++) {
 		mtp_request_free(dev->rx_req[i], dev->ep_out);
+		dev->rx_req[i] = NULL;
+	}
 	while ((req = mtp_req_get(dev, &dev->intr_idle)))
 		mtp_request_free(req, dev->ep_intr);
 	dev->state = STATE_OFFLINE;
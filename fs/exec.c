@@ -795,8 +795,12 @@ static int de_thread(struct task_struct *tsk)
 		list_replace_rcu(&leader->tasks, &tsk->tasks);
 		list_replace_init(&leader->sibling, &tsk->sibling);
 
+		/* siglock orders this against oom_adj_index_update() */
+		spin_lock(&tsk->sighand->siglock);
 		tsk->group_leader = tsk;
 		leader->group_leader = tsk;
+		oom_adj_index_replace(leader, tsk);
+		spin_unlock(&tsk->sighand->siglock);
 
 		tsk->exit_signal = SIGCHLD;
 		leader->exit_signal = -1;
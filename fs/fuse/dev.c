@@ -183,6 +183,9 @@ void fuse_put_request(struct fuse_conn *fc, struct fuse_req *req)
 		if (req->waiting)
 			atomic_dec(&fc->num_waiting);
 
+		if (req->passthrough_filp)
+			fput(req->passthrough_filp);
+
 		if (req->stolen_file)
 			put_reserved_req(fc, req);
 		else
@@ -202,27 +205,134 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+/*
+ * Request IDs step by two: the low bit is left free to tell the reply to
+ * an interrupt apart from the reply to the request it interrupts.
+ */
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
+	fc->reqctr += FUSE_REQ_ID_STEP;
 	
 	if (fc->reqctr == 0)
-		fc->reqctr = 1;
+		fc->reqctr = FUSE_REQ_ID_STEP;
 
 	return fc->reqctr;
 }
 
+/* A request and its interrupt share a bucket */
+static unsigned int fuse_req_hash(u64 unique)
+{
+	return (unique >> 1) & (FUSE_PQ_HASH_SIZE - 1);
+}
+
+/*
+ * Find the channel a request submitted on this CPU should go to. It is
+ * only handed to a channel that has a reader idle and nothing queued
+ * yet, so a request never waits behind a busy channel; otherwise it
+ * goes to the shared queue, which every reader takes from.
+ */
+static struct fuse_chan *fuse_select_chan(struct fuse_conn *fc)
+{
+	struct fuse_chan *chan;
+
+	if (!fc->nr_chans)
+		return NULL;
+
+	chan = fc->chans[raw_smp_processor_id() % fc->nr_chans];
+	if (!list_empty(&chan->pending) || !waitqueue_active(&chan->waitq))
+		return NULL;
+	return chan;
+}
+
+static struct fuse_chan *fuse_file_chan(struct fuse_conn *fc,
+					struct file *file)
+{
+	unsigned i;
+
+	for (i = 0; i < fc->nr_chans; i++) {
+		if (fc->chans[i]->file == file)
+			return fc->chans[i];
+	}
+	return NULL;
+}
+
+/*
+ * Lockless lookup for the read and reply fast paths.  A channel stays
+ * alive while its own file is in use and is freed after a grace period,
+ * so a racing release can at worst make this miss, and the caller then
+ * takes the locked path.
+ */
+static struct fuse_chan *fuse_dev_chan(struct fuse_conn *fc,
+				       struct file *file)
+{
+	struct fuse_chan *chan, *found = NULL;
+	unsigned i, nr;
+
+	rcu_read_lock();
+	nr = min_t(unsigned, ACCESS_ONCE(fc->nr_chans), FUSE_MAX_CHANS);
+	for (i = 0; i < nr; i++) {
+		chan = rcu_dereference_raw(fc->chans[i]);
+		if (chan && chan->file == file) {
+			found = chan;
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+/*
+ * A request queued on a channel is covered by the channel lock, taken
+ * inside fc->lock: its list, state and flags change under it.  req->chan
+ * only changes with both locks held, and never while the request is
+ * being copied, so the copy paths can use req_queue_lock() unlocked.
+ */
+static void fuse_chan_lock(struct fuse_chan *chan)
+{
+	if (chan)
+		spin_lock(&chan->lock);
+}
+
+static void fuse_chan_unlock(struct fuse_chan *chan)
+{
+	if (chan)
+		spin_unlock(&chan->lock);
+}
+
+static struct fuse_chan *fuse_req_chan_lock(struct fuse_req *req)
+{
+	struct fuse_chan *chan = req->chan;
+
+	fuse_chan_lock(chan);
+	return chan;
+}
+
+static spinlock_t *req_queue_lock(struct fuse_conn *fc, struct fuse_req *req)
+{
+	return req->chan ? &req->chan->lock : &fc->lock;
+}
+
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_chan *chan = fuse_select_chan(fc);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
+	if (chan) {
+		spin_lock(&chan->lock);
+		req->chan = chan;
+		list_add_tail(&req->list, &chan->pending);
+		spin_unlock(&chan->lock);
+		wake_up(&chan->waitq);
+	} else {
+		list_add_tail(&req->list, &fc->pending);
+		wake_up(&fc->waitq);
+	}
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 }
 
@@ -262,10 +372,14 @@ static void request_end(struct fuse_conn *fc, struct fuse_req *req)
 __releases(fc->lock)
 {
 	void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
+	struct fuse_chan *chan = fuse_req_chan_lock(req);
+
 	req->end = NULL;
 	list_del(&req->list);
-	list_del(&req->intr_entry);
 	req->state = FUSE_REQ_FINISHED;
+	req->chan = NULL;
+	fuse_chan_unlock(chan);
+	list_del(&req->intr_entry);
 	if (req->background) {
 		if (fc->num_background == fc->max_background) {
 			fc->blocked = 0;
@@ -307,10 +421,41 @@ static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 }
 
+/* Called with the request's queue lock held, see req_queue_lock() */
+static void request_end_unlock(struct fuse_conn *fc, struct fuse_req *req)
+{
+	if (req->chan) {
+		spin_unlock(&req->chan->lock);
+		spin_lock(&fc->lock);
+	}
+	request_end(fc, req);
+}
+
+/*
+ * A channel reader finds the request interrupted after sending it, with
+ * only the channel lock held.  Queue the interrupt under fc->lock unless
+ * the request has been answered in the meantime.
+ */
+static void queue_interrupt_sent(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_chan *chan;
+
+	spin_lock(&fc->lock);
+	chan = fuse_req_chan_lock(req);
+	if (req->state == FUSE_REQ_SENT && list_empty(&req->intr_entry))
+		queue_interrupt(fc, req);
+	fuse_chan_unlock(chan);
+	spin_unlock(&fc->lock);
+	fuse_put_request(fc, req);
+}
+
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	struct fuse_chan *chan;
+	int sent;
+
 	if (!fc->no_interrupt) {
 		
 		wait_answer_interruptible(fc, req);
@@ -320,8 +465,11 @@ __acquires(fc->lock)
 		if (req->state == FUSE_REQ_FINISHED)
 			return;
 
+		chan = fuse_req_chan_lock(req);
 		req->interrupted = 1;
-		if (req->state == FUSE_REQ_SENT)
+		sent = req->state == FUSE_REQ_SENT;
+		fuse_chan_unlock(chan);
+		if (sent)
 			queue_interrupt(fc, req);
 	}
 
@@ -339,12 +487,16 @@ __acquires(fc->lock)
 			return;
 
 		
+		chan = fuse_req_chan_lock(req);
 		if (req->state == FUSE_REQ_PENDING) {
 			list_del(&req->list);
+			req->chan = NULL;
+			fuse_chan_unlock(chan);
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
 			return;
 		}
+		fuse_chan_unlock(chan);
 	}
 
 	spin_unlock(&fc->lock);
@@ -448,12 +600,14 @@ static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
 {
 	int err = 0;
 	if (req) {
-		spin_lock(&fc->lock);
+		spinlock_t *lock = req_queue_lock(fc, req);
+
+		spin_lock(lock);
 		if (req->aborted)
 			err = -ENOENT;
 		else
 			req->locked = 1;
-		spin_unlock(&fc->lock);
+		spin_unlock(lock);
 	}
 	return err;
 }
@@ -461,11 +615,13 @@ static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
 static void unlock_request(struct fuse_conn *fc, struct fuse_req *req)
 {
 	if (req) {
-		spin_lock(&fc->lock);
+		spinlock_t *lock = req_queue_lock(fc, req);
+
+		spin_lock(lock);
 		req->locked = 0;
 		if (req->aborted)
 			wake_up(&req->waitq);
-		spin_unlock(&fc->lock);
+		spin_unlock(lock);
 	}
 }
 
@@ -630,6 +786,7 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 	struct page *newpage;
 	struct pipe_buffer *buf = cs->pipebufs;
 	struct address_space *mapping;
+	spinlock_t *lock;
 	pgoff_t index;
 
 	unlock_request(cs->fc, cs->req);
@@ -685,12 +842,13 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 		lru_cache_add_file(newpage);
 
 	err = 0;
-	spin_lock(&cs->fc->lock);
+	lock = req_queue_lock(cs->fc, cs->req);
+	spin_lock(lock);
 	if (cs->req->aborted)
 		err = -ENOENT;
 	else
 		*pagep = newpage;
-	spin_unlock(&cs->fc->lock);
+	spin_unlock(lock);
 
 	if (err) {
 		unlock_page(newpage);
@@ -836,20 +994,23 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+static int request_pending(struct fuse_conn *fc, struct fuse_chan *chan)
 {
 	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+		forget_pending(fc) || (chan && !list_empty(&chan->pending));
 }
 
-static void request_wait(struct fuse_conn *fc)
+static void request_wait(struct fuse_conn *fc, struct fuse_chan *chan)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
+	DECLARE_WAITQUEUE(chan_wait, current);
 
 	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	if (chan)
+		add_wait_queue_exclusive(&chan->waitq, &chan_wait);
+	while (fc->connected && !request_pending(fc, chan)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
@@ -859,6 +1020,8 @@ __acquires(fc->lock)
 		spin_lock(&fc->lock);
 	}
 	set_current_state(TASK_RUNNING);
+	if (chan)
+		remove_wait_queue(&chan->waitq, &chan_wait);
 	remove_wait_queue(&fc->waitq, &wait);
 }
 
@@ -872,7 +1035,7 @@ __releases(fc->lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = req->in.h.unique | FUSE_INT_REQ_BIT;
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -1006,27 +1169,86 @@ __releases(fc->lock)
 		return fuse_read_batch_forget(fc, cs, nbytes);
 }
 
+/*
+ * Serve whichever of the channel's own queue and the shared queue has the
+ * older head, so that a busy channel cannot starve the shared requests.
+ * Uniques are handed out in submission order under fc->lock.  Called with
+ * fc->lock and the channel lock held.
+ */
+static struct list_head *fuse_chan_next_pending(struct fuse_conn *fc,
+						struct fuse_chan *chan)
+{
+	struct fuse_req *own, *shared;
+
+	if (!chan || list_empty(&chan->pending))
+		return &fc->pending;
+	if (list_empty(&fc->pending))
+		return &chan->pending;
+
+	own = list_first_entry(&chan->pending, struct fuse_req, list);
+	shared = list_first_entry(&fc->pending, struct fuse_req, list);
+	if (own->in.h.unique < shared->in.h.unique)
+		return &chan->pending;
+	return &fc->pending;
+}
+
+/*
+ * Fast path for a reader on a cloned channel: with nothing waiting on the
+ * shared queues, take the channel's next request under the channel lock
+ * alone.  The shared queues are only peeked at, fc->lock decides.
+ */
+static struct fuse_req *fuse_chan_dequeue(struct fuse_conn *fc,
+					  struct fuse_chan *chan)
+{
+	struct fuse_req *req = NULL;
+
+	if (!list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
+	    forget_pending(fc))
+		return NULL;
+
+	spin_lock(&chan->lock);
+	if (fc->connected && !list_empty(&chan->pending)) {
+		req = list_entry(chan->pending.next, struct fuse_req, list);
+		req->state = FUSE_REQ_READING;
+		list_move(&req->list, &chan->io);
+	}
+	spin_unlock(&chan->lock);
+	return req;
+}
+
 static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
+	struct fuse_chan *chan;
+	struct list_head *pending;
+	struct list_head *processing;
+	spinlock_t *lock;
 	unsigned reqsize;
 
  restart:
+	chan = fuse_dev_chan(fc, file);
+	if (chan) {
+		req = fuse_chan_dequeue(fc, chan);
+		if (req)
+			goto copy;
+	}
+
 	spin_lock(&fc->lock);
+	chan = fuse_file_chan(fc, file);
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(fc, chan))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(fc, chan);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(fc, chan))
 		goto err_unlock;
 
 	if (!list_empty(&fc->interrupts)) {
@@ -1035,18 +1257,38 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
+	fuse_chan_lock(chan);
+	pending = fuse_chan_next_pending(fc, chan);
+
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+		if (list_empty(pending) || fc->forget_batch-- > 0) {
+			fuse_chan_unlock(chan);
 			return fuse_read_forget(fc, cs, nbytes);
+		}
 
 		if (fc->forget_batch <= -8)
 			fc->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	/* another reader of this channel got there first */
+	if (list_empty(pending)) {
+		fuse_chan_unlock(chan);
+		spin_unlock(&fc->lock);
+		goto restart;
+	}
+
+	req = list_entry(pending->next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, req->chan ? &chan->io : &fc->io);
+	fuse_chan_unlock(chan);
+	/* the wakeup may have been meant for the other queue, pass it on */
+	if (pending != &fc->pending && !list_empty(&fc->pending))
+		wake_up(&fc->waitq);
+	else if (pending == &fc->pending && chan && !list_empty(&chan->pending))
+		wake_up(&chan->waitq);
+	spin_unlock(&fc->lock);
 
+ copy:
 	in = &req->in;
 	reqsize = in->h.len;
 	
@@ -1055,35 +1297,44 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		
 		if (in->h.opcode == FUSE_SETXATTR)
 			req->out.h.error = -E2BIG;
+		spin_lock(&fc->lock);
 		request_end(fc, req);
 		goto restart;
 	}
-	spin_unlock(&fc->lock);
 	cs->req = req;
 	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
 	if (!err)
 		err = fuse_copy_args(cs, in->numargs, in->argpages,
 				     (struct fuse_arg *) in->args, 0);
 	fuse_copy_finish(cs);
-	spin_lock(&fc->lock);
+	lock = req_queue_lock(fc, req);
+	spin_lock(lock);
 	req->locked = 0;
 	if (req->aborted) {
-		request_end(fc, req);
+		request_end_unlock(fc, req);
 		return -ENODEV;
 	}
 	if (err) {
 		req->out.h.error = -EIO;
-		request_end(fc, req);
+		request_end_unlock(fc, req);
 		return err;
 	}
 	if (!req->isreply)
-		request_end(fc, req);
+		request_end_unlock(fc, req);
 	else {
+		processing = req->chan ? req->chan->processing : fc->processing;
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list,
+			       &processing[fuse_req_hash(req->in.h.unique)]);
+		if (req->interrupted && req->chan) {
+			__fuse_get_request(req);
+			spin_unlock(lock);
+			queue_interrupt_sent(fc, req);
+			return reqsize;
+		}
 		if (req->interrupted)
 			queue_interrupt(fc, req);
-		spin_unlock(&fc->lock);
+		spin_unlock(lock);
 	}
 	return reqsize;
 
@@ -1565,19 +1816,81 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 	}
 }
 
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find_list(struct list_head *processing,
+					  u64 unique)
 {
-	struct list_head *entry;
+	struct fuse_req *req;
 
-	list_for_each(entry, &fc->processing) {
-		struct fuse_req *req;
-		req = list_entry(entry, struct fuse_req, list);
+	list_for_each_entry(req, &processing[fuse_req_hash(unique)], list) {
 		if (req->in.h.unique == unique || req->intr_unique == unique)
 			return req;
 	}
 	return NULL;
 }
 
+/*
+ * Look a reply up among the requests sent from the shared queue, then
+ * among those of every channel.  A request found on a channel is returned
+ * with the channel lock held, in *chanp.
+ */
+static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique,
+				     struct fuse_chan **chanp)
+{
+	struct fuse_req *req;
+	unsigned i;
+
+	*chanp = NULL;
+	req = request_find_list(fc->processing, unique);
+	if (req)
+		return req;
+
+	for (i = 0; i < fc->nr_chans; i++) {
+		struct fuse_chan *chan = fc->chans[i];
+
+		spin_lock(&chan->lock);
+		req = request_find_list(chan->processing, unique);
+		if (req) {
+			*chanp = chan;
+			return req;
+		}
+		spin_unlock(&chan->lock);
+	}
+	return NULL;
+}
+
+/*
+ * Fast path for a reply written on the channel the request was read
+ * from: it is found and taken under the channel lock alone.  Replies to
+ * interrupts, and replies written on another fd, take the locked path.
+ */
+static struct fuse_req *fuse_chan_reply(struct fuse_conn *fc,
+					struct fuse_chan *chan,
+					struct fuse_copy_state *cs,
+					struct fuse_out_header *oh)
+{
+	struct fuse_req *req;
+
+	if (oh->unique & FUSE_INT_REQ_BIT)
+		return NULL;
+
+	spin_lock(&chan->lock);
+	req = request_find_list(chan->processing, oh->unique);
+	if (!req || req->aborted || !fc->connected) {
+		spin_unlock(&chan->lock);
+		return NULL;
+	}
+	req->state = FUSE_REQ_WRITING;
+	list_move(&req->list, &chan->io);
+	req->out.h = *oh;
+	req->locked = 1;
+	spin_unlock(&chan->lock);
+
+	cs->req = req;
+	if (!req->out.page_replace)
+		cs->move_pages = 0;
+	return req;
+}
+
 static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
 			 unsigned nbytes)
 {
@@ -1601,11 +1914,12 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
 			      out->page_zeroing);
 }
 
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_conn *fc, struct file *file,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
 	struct fuse_req *req;
+	struct fuse_chan *chan;
 	struct fuse_out_header oh;
 
 	if (nbytes < sizeof(struct fuse_out_header))
@@ -1628,16 +1942,24 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (oh.error <= -1000 || oh.error > 0)
 		goto err_finish;
 
+	chan = fuse_dev_chan(fc, file);
+	if (chan) {
+		req = fuse_chan_reply(fc, chan, cs, &oh);
+		if (req)
+			goto copy;
+	}
+
 	spin_lock(&fc->lock);
 	err = -ENOENT;
 	if (!fc->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(fc, oh.unique, &chan);
 	if (!req)
 		goto err_unlock;
 
 	if (req->aborted) {
+		fuse_chan_unlock(chan);
 		spin_unlock(&fc->lock);
 		fuse_copy_finish(cs);
 		spin_lock(&fc->lock);
@@ -1646,6 +1968,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	}
 	
 	if (req->intr_unique == oh.unique) {
+		fuse_chan_unlock(chan);
 		err = -EINVAL;
 		if (nbytes != sizeof(struct fuse_out_header))
 			goto err_unlock;
@@ -1660,26 +1983,32 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 		return nbytes;
 	}
 
+	/* off its channel, if it was on one: fc->lock covers it from now on */
+	req->chan = NULL;
 	req->state = FUSE_REQ_WRITING;
 	list_move(&req->list, &fc->io);
 	req->out.h = oh;
 	req->locked = 1;
+	fuse_chan_unlock(chan);
 	cs->req = req;
 	if (!req->out.page_replace)
 		cs->move_pages = 0;
 	spin_unlock(&fc->lock);
 
+ copy:
 	err = copy_out_args(cs, &req->out, nbytes);
 	fuse_copy_finish(cs);
+	if (!err)
+		fuse_passthrough_setup(fc, req);
 
-	spin_lock(&fc->lock);
+	spin_lock(req_queue_lock(fc, req));
 	req->locked = 0;
 	if (!err) {
 		if (req->aborted)
 			err = -ENOENT;
 	} else if (!req->aborted)
 		req->out.h.error = -EIO;
-	request_end(fc, req);
+	request_end_unlock(fc, req);
 
 	return err ? err : nbytes;
 
@@ -1694,13 +2023,14 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
+	struct file *file = iocb->ki_filp;
+	struct fuse_conn *fc = fuse_get_conn(file);
 	if (!fc)
 		return -EPERM;
 
 	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_write(fc, file, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1770,7 +2100,7 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(fc, out, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -1785,15 +2115,22 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
 	struct fuse_conn *fc = fuse_get_conn(file);
+	struct fuse_chan *chan;
 	if (!fc)
 		return POLLERR;
 
+	spin_lock(&fc->lock);
+	chan = fuse_file_chan(fc, file);
+	spin_unlock(&fc->lock);
+
 	poll_wait(file, &fc->waitq, wait);
+	if (chan)
+		poll_wait(file, &chan->waitq, wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(fc, chan))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
@@ -1813,19 +2150,46 @@ __acquires(fc->lock)
 	}
 }
 
+/* Find a channel with requests being copied, and return it locked */
+static struct fuse_chan *fuse_chan_busy(struct fuse_conn *fc)
+{
+	unsigned i;
+
+	for (i = 0; i < fc->nr_chans; i++) {
+		struct fuse_chan *chan = fc->chans[i];
+
+		spin_lock(&chan->lock);
+		if (!list_empty(&chan->io))
+			return chan;
+		spin_unlock(&chan->lock);
+	}
+	return NULL;
+}
+
 static void end_io_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
-	while (!list_empty(&fc->io)) {
-		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
-		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
-
+	for (;;) {
+		struct fuse_chan *chan = NULL;
+		struct list_head *io = &fc->io;
+		struct fuse_req *req;
+		void (*end) (struct fuse_conn *, struct fuse_req *);
+
+		/* fc->lock may have been dropped, so look the channel up again */
+		if (list_empty(io)) {
+			chan = fuse_chan_busy(fc);
+			if (!chan)
+				break;
+			io = &chan->io;
+		}
+		req = list_entry(io->next, struct fuse_req, list);
+		end = req->end;
 		req->aborted = 1;
 		req->out.h.error = -ECONNABORTED;
 		req->state = FUSE_REQ_FINISHED;
 		list_del_init(&req->list);
+		fuse_chan_unlock(chan);
 		wake_up(&req->waitq);
 		if (end) {
 			req->end = NULL;
@@ -1839,14 +2203,40 @@ __acquires(fc->lock)
 	}
 }
 
+/*
+ * Hand the requests queued and sent on a channel over to the shared
+ * queues.  Called with fc->lock held.
+ */
+static void fuse_chan_unqueue(struct fuse_conn *fc, struct fuse_chan *chan)
+{
+	struct fuse_req *req;
+	int i;
+
+	spin_lock(&chan->lock);
+	list_for_each_entry(req, &chan->pending, list)
+		req->chan = NULL;
+	list_splice_init(&chan->pending, &fc->pending);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++) {
+		list_for_each_entry(req, &chan->processing[i], list)
+			req->chan = NULL;
+		list_splice_tail_init(&chan->processing[i], &fc->processing[i]);
+	}
+	spin_unlock(&chan->lock);
+}
+
 static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	int i;
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
+	for (i = 0; i < fc->nr_chans; i++)
+		fuse_chan_unqueue(fc, fc->chans[i]);
 	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		end_requests(fc, &fc->processing[i]);
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -1883,15 +2273,53 @@ void fuse_abort_conn(struct fuse_conn *fc)
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * Closing a cloned channel hands whatever is queued or awaiting a reply
+ * on it back to the shared queues; only closing the original device ends
+ * the connection.
+ */
+static bool fuse_chan_release(struct fuse_conn *fc, struct file *file)
+{
+	struct fuse_chan *chan;
+	unsigned i;
+
+	spin_lock(&fc->lock);
+	for (i = 0; i < fc->nr_chans; i++) {
+		if (fc->chans[i]->file == file)
+			break;
+	}
+	if (i == fc->nr_chans) {
+		spin_unlock(&fc->lock);
+		return false;
+	}
+
+	chan = fc->chans[i];
+	fc->chans[i] = fc->chans[--fc->nr_chans];
+	fc->chans[fc->nr_chans] = NULL;
+	fuse_chan_unqueue(fc, chan);
+	if (!list_empty(&fc->pending))
+		wake_up_all(&fc->waitq);
+	spin_unlock(&fc->lock);
+
+	kfree_rcu(chan, rcu);
+	return true;
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
 	struct fuse_conn *fc = fuse_get_conn(file);
 	if (fc) {
+		if (fuse_chan_release(fc, file)) {
+			fuse_conn_put(fc);
+			return 0;
+		}
+
 		spin_lock(&fc->lock);
 		fc->connected = 0;
 		fc->blocked = 0;
 		end_queued_requests(fc);
 		end_polls(fc);
+		wake_up_all(&fc->waitq);
 		wake_up_all(&fc->blocked_waitq);
 		spin_unlock(&fc->lock);
 		fuse_conn_put(fc);
@@ -1901,6 +2329,86 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 }
 EXPORT_SYMBOL_GPL(fuse_dev_release);
 
+/*
+ * Attach a freshly opened /dev/fuse to the connection behind oldfd, as an
+ * extra channel with its own lock and request queues. A multithreaded
+ * daemon gives each thread its own channel, and requests submitted on CPU
+ * n are handed to channel n % nr_chans when that channel has a reader
+ * waiting.
+ */
+static int fuse_dev_clone(struct file *file, int oldfd)
+{
+	struct file *old;
+	struct fuse_conn *fc;
+	struct fuse_chan *chan;
+	int err;
+	int i;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	err = -ENOMEM;
+	chan = kzalloc(sizeof(*chan), GFP_KERNEL);
+	if (!chan)
+		goto out_fput;
+	chan->file = file;
+	INIT_LIST_HEAD(&chan->pending);
+	init_waitqueue_head(&chan->waitq);
+	spin_lock_init(&chan->lock);
+	INIT_LIST_HEAD(&chan->io);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&chan->processing[i]);
+
+	mutex_lock(&fuse_mutex);
+	err = -EINVAL;
+	fc = fuse_get_conn(old);
+	if (old->f_op != &fuse_dev_operations || !fc ||
+	    file->f_op != &fuse_dev_operations || fuse_get_conn(file))
+		goto out_unlock;
+
+	spin_lock(&fc->lock);
+	err = -ENODEV;
+	if (!fc->connected)
+		goto out_unlock_fc;
+	err = -ENOSPC;
+	if (fc->nr_chans == FUSE_MAX_CHANS)
+		goto out_unlock_fc;
+	chan->fc = fuse_conn_get(fc);
+	rcu_assign_pointer(fc->chans[fc->nr_chans], chan);
+	fc->nr_chans++;
+	spin_unlock(&fc->lock);
+
+	file->private_data = fc;
+	mutex_unlock(&fuse_mutex);
+	fput(old);
+	return 0;
+
+ out_unlock_fc:
+	spin_unlock(&fc->lock);
+ out_unlock:
+	mutex_unlock(&fuse_mutex);
+	kfree(chan);
+ out_fput:
+	fput(old);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	__u32 oldfd;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		if (get_user(oldfd, (__u32 __user *) arg))
+			return -EFAULT;
+		return fuse_dev_clone(file, oldfd);
+	default:
+		return -ENOTTY;
+	}
+}
+
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
 	struct fuse_conn *fc = fuse_get_conn(file);
@@ -1923,6 +2431,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -31,6 +31,17 @@
 
 #define FUSE_CTL_NUM_DENTRIES 5
 
+#define FUSE_SUPER_MAGIC 0x65735546
+
+#define FUSE_INT_REQ_BIT (1ULL << 0)
+
+#define FUSE_REQ_ID_STEP (1ULL << 1)
+
+#define FUSE_PQ_HASH_BITS 8
+#define FUSE_PQ_HASH_SIZE (1 << FUSE_PQ_HASH_BITS)
+
+#define FUSE_MAX_CHANS 32
+
 #define FUSE_DEFAULT_PERMISSIONS (1 << 0)
 
 #define FUSE_ALLOW_OTHER         (1 << 1)
@@ -120,6 +131,9 @@ struct fuse_file {
 
 	
 	bool flock:1;
+
+	
+	struct file *passthrough_filp;
 };
 
 struct fuse_in_arg {
@@ -185,6 +199,9 @@ struct fuse_req {
 	struct list_head intr_entry;
 
 	
+	struct fuse_chan *chan;
+
+	
 	atomic_t count;
 
 	
@@ -271,6 +288,35 @@ struct fuse_req {
 
 	
 	struct file *stolen_file;
+
+	
+	struct file *passthrough_filp;
+};
+
+struct fuse_chan {
+	
+	struct fuse_conn *fc;
+
+	
+	struct file *file;
+
+	
+	struct list_head pending;
+
+	
+	wait_queue_head_t waitq;
+
+	
+	spinlock_t lock;
+
+	
+	struct list_head io;
+
+	
+	struct list_head processing[FUSE_PQ_HASH_SIZE];
+
+	
+	struct rcu_head rcu;
 };
 
 struct fuse_conn {
@@ -305,12 +351,18 @@ struct fuse_conn {
 	struct list_head pending;
 
 	
-	struct list_head processing;
+	struct list_head processing[FUSE_PQ_HASH_SIZE];
 
 	
 	struct list_head io;
 
 	
+	struct fuse_chan *chans[FUSE_MAX_CHANS];
+
+	
+	unsigned nr_chans;
+
+	
 	u64 khctr;
 
 	
@@ -421,6 +473,9 @@ struct fuse_conn {
 	unsigned no_flock:1;
 
 	
+	unsigned passthrough:1;
+
+	
 	atomic_t num_waiting;
 
 	
@@ -614,4 +669,40 @@ int fuse_dev_release(struct inode *inode, struct file *file);
 
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
+#ifdef CONFIG_FUSE_PASSTHROUGH
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_req *req);
+void fuse_passthrough_open(struct file *file, struct fuse_file *ff);
+void fuse_passthrough_release(struct fuse_file *ff);
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos);
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb, const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+#else
+static inline void fuse_passthrough_setup(struct fuse_conn *fc,
+					  struct fuse_req *req) { }
+static inline void fuse_passthrough_open(struct file *file,
+					 struct fuse_file *ff) { }
+static inline void fuse_passthrough_release(struct fuse_file *ff) { }
+static inline ssize_t fuse_passthrough_aio_read(struct kiocb *iocb,
+						const struct iovec *iov,
+						unsigned long nr_segs,
+						loff_t pos)
+{
+	return -EINVAL;
+}
+static inline ssize_t fuse_passthrough_aio_write(struct kiocb *iocb,
+						 const struct iovec *iov,
+						 unsigned long nr_segs,
+						 loff_t pos)
+{
+	return -EINVAL;
+}
+static inline int fuse_passthrough_mmap(struct file *file,
+					struct vm_area_struct *vma)
+{
+	return -ENODEV;
+}
+#endif
+
 #endif 
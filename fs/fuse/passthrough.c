@@ -0,0 +1,196 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2008  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+/*
+ * Passthrough: the daemon answers FUSE_OPEN/FUSE_CREATE with
+ * FOPEN_PASSTHROUGH and a descriptor of its own backing file.  Reads,
+ * writes and mmaps of the FUSE file then go straight to that file instead
+ * of round-tripping through the daemon.  Access was decided by the daemon
+ * at open time; the I/O itself runs with the daemon's credentials, the
+ * ones the backing file was opened with.
+ */
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/cred.h>
+#include <linux/capability.h>
+
+static struct fuse_open_out *fuse_passthrough_outarg(struct fuse_req *req)
+{
+	switch (req->in.h.opcode) {
+	case FUSE_OPEN:
+		return req->out.args[0].value;
+	case FUSE_CREATE:
+		return req->out.args[1].value;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Called from the reply path, in the context of the daemon, so that the
+ * descriptor is looked up in the daemon's file table.  If the backing file
+ * is unsuitable the open silently falls back to normal FUSE I/O.
+ *
+ * I/O on the backing file later runs with the daemon's credentials on
+ * behalf of whoever opened the FUSE file, so only a privileged daemon may
+ * hand one over.
+ */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_open_out *outarg;
+	struct file *filp;
+	struct inode *inode;
+
+	if (!fc->passthrough || req->out.h.error)
+		return;
+
+	outarg = fuse_passthrough_outarg(req);
+	if (!outarg || !(outarg->open_flags & FOPEN_PASSTHROUGH))
+		return;
+	outarg->open_flags &= ~FOPEN_PASSTHROUGH;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return;
+
+	filp = fget(outarg->passthrough_fd);
+	if (!filp)
+		return;
+
+	inode = filp->f_path.dentry->d_inode;
+	if (!S_ISREG(inode->i_mode) ||
+	    inode->i_sb->s_magic == FUSE_SUPER_MAGIC ||
+	    !filp->f_op || (!filp->f_op->read && !filp->f_op->aio_read)) {
+		fput(filp);
+		return;
+	}
+
+	outarg->open_flags |= FOPEN_PASSTHROUGH;
+	req->passthrough_filp = filp;
+}
+
+/*
+ * The backing file must allow everything the FUSE file was opened for,
+ * otherwise I/O would fail where the daemon already said it may proceed.
+ */
+void fuse_passthrough_open(struct file *file, struct fuse_file *ff)
+{
+	struct file *filp = ff->passthrough_filp;
+
+	if (!filp)
+		return;
+
+	if ((file->f_mode & ~filp->f_mode) & (FMODE_READ | FMODE_WRITE) ||
+	    ((file->f_flags & O_APPEND) && !(filp->f_flags & O_APPEND))) {
+		fuse_passthrough_release(ff);
+		return;
+	}
+
+	ff->open_flags &= ~FOPEN_DIRECT_IO;
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough_filp) {
+		fput(ff->passthrough_filp);
+		ff->passthrough_filp = NULL;
+	}
+}
+
+static ssize_t fuse_passthrough_rw(struct kiocb *iocb, const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos, int write)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct file *filp = ff->passthrough_filp;
+	const struct cred *old_cred;
+	unsigned long seg;
+	ssize_t ret = 0;
+
+	old_cred = override_creds(filp->f_cred);
+	for (seg = 0; seg < nr_segs; seg++) {
+		size_t len = iov[seg].iov_len;
+		ssize_t nr;
+
+		if (!len)
+			continue;
+		if (write)
+			nr = vfs_write(filp, iov[seg].iov_base, len, &pos);
+		else
+			nr = vfs_read(filp, iov[seg].iov_base, len, &pos);
+		if (nr < 0) {
+			if (!ret)
+				ret = nr;
+			break;
+		}
+		ret += nr;
+		if (nr != len)
+			break;
+	}
+	revert_creds(old_cred);
+
+	if (ret > 0)
+		iocb->ki_pos = pos;
+	return ret;
+}
+
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos)
+{
+	return fuse_passthrough_rw(iocb, iov, nr_segs, pos, 0);
+}
+
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb, const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos)
+{
+	struct inode *inode = iocb->ki_filp->f_mapping->host;
+	ssize_t ret;
+
+	ret = fuse_passthrough_rw(iocb, iov, nr_segs, pos, 1);
+	if (ret > 0) {
+		/* the write may have been appended, so use where it ended */
+		pos = iocb->ki_pos;
+		fuse_write_update_size(inode, pos);
+		if (inode->i_mapping->nrpages)
+			invalidate_inode_pages2_range(inode->i_mapping,
+				(pos - ret) >> PAGE_CACHE_SHIFT,
+				(pos - 1) >> PAGE_CACHE_SHIFT);
+		fuse_invalidate_attr(inode);
+	}
+	return ret;
+}
+
+/*
+ * Map the backing file itself, so that faults are served from its page
+ * cache.  The vma takes over a reference to the backing file and drops the
+ * one mmap_region() took on the FUSE file.
+ */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *filp = ff->passthrough_filp;
+	int err;
+
+	if (!filp->f_op->mmap)
+		return -ENODEV;
+
+	get_file(filp);
+	vma->vm_file = filp;
+	err = filp->f_op->mmap(filp, vma);
+	if (err) {
+		vma->vm_file = file;
+		fput(filp);
+		return err;
+	}
+	fput(file);
+	return 0;
+}
@@ -11,6 +11,7 @@
 #define _LINUX_FUSE_H
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 
 #define FUSE_KERNEL_VERSION 7
@@ -73,6 +74,7 @@ struct fuse_file_lock {
 #define FOPEN_DIRECT_IO		(1 << 0)
 #define FOPEN_KEEP_CACHE	(1 << 1)
 #define FOPEN_NONSEEKABLE	(1 << 2)
+#define FOPEN_PASSTHROUGH	(1 << 3)
 
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -82,6 +84,7 @@ struct fuse_file_lock {
 #define FUSE_BIG_WRITES		(1 << 5)
 #define FUSE_DONT_MASK		(1 << 6)
 #define FUSE_FLOCK_LOCKS	(1 << 10)
+#define FUSE_PASSTHROUGH	(1 << 31)
 
 #define CUSE_UNRESTRICTED_IOCTL	(1 << 0)
 
@@ -165,6 +168,8 @@ enum fuse_notify_code {
 
 #define FUSE_MIN_READ_BUFFER 8192
 
+#define FUSE_DEV_IOC_CLONE	_IOR(229, 0, __u32)
+
 #define FUSE_COMPAT_ENTRY_OUT_SIZE 120
 
 struct fuse_entry_out {
@@ -262,7 +267,7 @@ struct fuse_create_in {
 struct fuse_open_out {
 	__u64	fh;
 	__u32	open_flags;
-	__u32	padding;
+	__u32	passthrough_fd;
 };
 
 struct fuse_release_in {
@@ -224,6 +224,7 @@ enum mmc_packed_stop_reasons {
 	EMPTY_QUEUE,
 	REL_WRITE,
 	THRESHOLD,
+	LATENCY_BUDGET,
 	MAX_REASONS,
 };
 
@@ -233,6 +234,9 @@ struct mmc_wr_pack_stats {
 	spinlock_t lock;
 	bool enabled;
 	bool print_in_read;
+	/* write throughput measured at completion (KB/s) */
+	u32 single_wr_tput;
+	u32 packed_wr_tput;
 };
 
 struct mmc_card {
@@ -1,6 +1,8 @@
 #ifndef _XT_QTAGUID_MATCH_H
 #define _XT_QTAGUID_MATCH_H
 
+#include <linux/if.h>
+#include <linux/types.h>
 #include <linux/netfilter/xt_owner.h>
 
 #define XT_QTAGUID_UID    XT_OWNER_UID
@@ -8,4 +10,48 @@
 #define XT_QTAGUID_SOCKET XT_OWNER_SOCKET
 #define xt_qtaguid_match_info xt_owner_match_info
 
+/*
+ * Binary stats, read from /proc/net/xt_qtaguid/stats_delta.
+ *
+ * A read at offset 0 takes a new snapshot: an xt_qtaguid_stats_hdr
+ * followed by rec_count records of rec_size bytes. Only the entries that
+ * changed since the cookie of the previous snapshot taken through the same
+ * open file are included. Writing a decimal cookie to the file makes the
+ * next snapshot start from that cookie instead, 0 asks for everything.
+ *
+ * If XT_QTAGUID_STATS_FULL is set the snapshot holds every entry and
+ * earlier results should be dropped, as some entries have been deleted
+ * since the cookie.
+ */
+#define XT_QTAGUID_STATS_VERSION 1
+#define XT_QTAGUID_STATS_FULL    (1 << 0)
+
+struct xt_qtaguid_stats_hdr {
+	__u32 version;
+	__u32 flags;
+	__u64 cookie;
+	__u32 rec_size;
+	__u32 rec_count;
+};
+
+/* Indexes into xt_qtaguid_stats_rec.bpc */
+#define XT_QTAGUID_STATS_TX      0
+#define XT_QTAGUID_STATS_RX      1
+#define XT_QTAGUID_STATS_DIRS    2
+#define XT_QTAGUID_STATS_TCP     0
+#define XT_QTAGUID_STATS_UDP     1
+#define XT_QTAGUID_STATS_OTHER   2
+#define XT_QTAGUID_STATS_PROTOS  3
+
+struct xt_qtaguid_stats_rec {
+	char iface[IFNAMSIZ];
+	__u64 acct_tag;
+	__u32 uid;
+	__u32 cnt_set;
+	struct {
+		__u64 bytes;
+		__u64 packets;
+	} bpc[XT_QTAGUID_STATS_DIRS][XT_QTAGUID_STATS_PROTOS];
+};
+
 #endif 
@@ -29,6 +29,47 @@ enum oom_constraint {
 extern void compare_swap_oom_score_adj(int old_val, int new_val);
 extern int test_set_oom_score_adj(int new_val);
 
+#ifdef CONFIG_OOM_SCORE_ADJ_INDEX
+#define OOM_ADJ_INDEX_SHIFT	4
+#define OOM_ADJ_INDEX_BUCKETS	\
+	(((OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN) >> OOM_ADJ_INDEX_SHIFT) + 1)
+
+static inline int oom_adj_index_bucket(int oom_score_adj)
+{
+	return (oom_score_adj - OOM_SCORE_ADJ_MIN) >> OOM_ADJ_INDEX_SHIFT;
+}
+
+extern struct hlist_nulls_head oom_adj_index[OOM_ADJ_INDEX_BUCKETS];
+
+extern void oom_adj_index_init(void);
+extern void oom_adj_index_add(struct task_struct *p);
+extern void oom_adj_index_del(struct task_struct *p);
+extern void oom_adj_index_replace(struct task_struct *old,
+				  struct task_struct *new);
+extern void oom_adj_index_update(struct task_struct *p);
+#else
+static inline void oom_adj_index_init(void)
+{
+}
+
+static inline void oom_adj_index_add(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_index_del(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_index_replace(struct task_struct *old,
+					 struct task_struct *new)
+{
+}
+
+static inline void oom_adj_index_update(struct task_struct *p)
+{
+}
+#endif
+
 extern unsigned int oom_badness(struct task_struct *p, struct mem_cgroup *memcg,
 			const nodemask_t *nodemask, unsigned long totalpages);
 extern int try_set_zonelist_oom(struct zonelist *zonelist, gfp_t gfp_flags);
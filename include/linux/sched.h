@@ -69,6 +69,7 @@ struct sched_param {
 #include <linux/seccomp.h>
 #include <linux/rcupdate.h>
 #include <linux/rculist.h>
+#include <linux/list_nulls.h>
 #include <linux/rtmutex.h>
 
 #include <linux/time.h>
@@ -120,6 +121,21 @@ extern unsigned long this_cpu_load(void);
 
 extern void sched_get_nr_running_avg(int *avg, int *iowait_avg);
 
+/*
+ * Passed to the sched_wakeup notifiers after a task has been woken up or
+ * forked onto dest_cpu, which may differ from the cpu it last ran on.
+ */
+struct sched_wakeup_notify_data {
+	int src_cpu;
+	int dest_cpu;
+	/* runnable tasks on dest_cpu, the new one included */
+	unsigned int nr_running;
+};
+
+struct notifier_block;
+extern int sched_wakeup_notifier_register(struct notifier_block *nb);
+extern int sched_wakeup_notifier_unregister(struct notifier_block *nb);
+
 extern void calc_global_load(unsigned long ticks);
 
 extern unsigned long get_parent_ip(unsigned long addr);
@@ -1052,6 +1068,9 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_OOM_SCORE_ADJ_INDEX
+	struct hlist_nulls_node oom_adj_node;
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
@@ -0,0 +1,63 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cpufreq_governor
+
+#if !defined(_TRACE_CPUFREQ_GOVERNOR_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CPUFREQ_GOVERNOR_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Common to the sampling governors, so that their decisions on the same
+ * workload can be compared. load is in percent of the current frequency.
+ */
+TRACE_EVENT(cpufreq_governor_load,
+	    TP_PROTO(const char *governor, unsigned int cpu_id,
+		     unsigned int load, unsigned int curfreq),
+	    TP_ARGS(governor, cpu_id, load, curfreq),
+
+	    TP_STRUCT__entry(
+		    __string(governor, governor)
+		    __field(unsigned int, cpu_id   )
+		    __field(unsigned int, load     )
+		    __field(unsigned int, curfreq  )
+	    ),
+
+	    TP_fast_assign(
+		    __assign_str(governor, governor);
+		    __entry->cpu_id = cpu_id;
+		    __entry->load = load;
+		    __entry->curfreq = curfreq;
+	    ),
+
+	    TP_printk("governor=%s cpu=%u load=%u cur=%u",
+		      __get_str(governor), __entry->cpu_id, __entry->load,
+		      __entry->curfreq)
+);
+
+TRACE_EVENT(cpufreq_governor_target,
+	    TP_PROTO(const char *governor, unsigned int cpu_id,
+		     unsigned int curfreq, unsigned int targfreq),
+	    TP_ARGS(governor, cpu_id, curfreq, targfreq),
+
+	    TP_STRUCT__entry(
+		    __string(governor, governor)
+		    __field(unsigned int, cpu_id   )
+		    __field(unsigned int, curfreq  )
+		    __field(unsigned int, targfreq )
+	    ),
+
+	    TP_fast_assign(
+		    __assign_str(governor, governor);
+		    __entry->cpu_id = cpu_id;
+		    __entry->curfreq = curfreq;
+		    __entry->targfreq = targfreq;
+	    ),
+
+	    TP_printk("governor=%s cpu=%u cur=%u targ=%u",
+		      __get_str(governor), __entry->cpu_id, __entry->curfreq,
+		      __entry->targfreq)
+);
+
+#endif
+
+#include <trace/define_trace.h>
@@ -82,6 +82,33 @@ DEFINE_EVENT(loadeval, cpufreq_interactive_notyet,
 	    TP_ARGS(cpu_id, load, curfreq, targfreq)
 );
 
+TRACE_EVENT(cpufreq_interactive_sched,
+	    TP_PROTO(unsigned long cpu_id, unsigned long src_cpu,
+		     unsigned long nr_running, unsigned long curfreq,
+		     unsigned long targfreq),
+	    TP_ARGS(cpu_id, src_cpu, nr_running, curfreq, targfreq),
+
+	    TP_STRUCT__entry(
+		    __field(unsigned long, cpu_id    )
+		    __field(unsigned long, src_cpu   )
+		    __field(unsigned long, nr_running)
+		    __field(unsigned long, curfreq   )
+		    __field(unsigned long, targfreq  )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->cpu_id = cpu_id;
+		    __entry->src_cpu = src_cpu;
+		    __entry->nr_running = nr_running;
+		    __entry->curfreq = curfreq;
+		    __entry->targfreq = targfreq;
+	    ),
+
+	    TP_printk("cpu=%lu src=%lu nr_running=%lu cur=%lu targ=%lu",
+		      __entry->cpu_id, __entry->src_cpu, __entry->nr_running,
+		      __entry->curfreq, __entry->targfreq)
+);
+
 TRACE_EVENT(cpufreq_interactive_boost,
 	    TP_PROTO(const char *s),
 	    TP_ARGS(s),
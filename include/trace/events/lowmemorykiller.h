@@ -0,0 +1,69 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_LOWMEMORYKILLER_H
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmem_pressure,
+
+	TP_PROTO(unsigned long scanned, unsigned long reclaimed,
+		 unsigned long allocstall, int pressure),
+
+	TP_ARGS(scanned, reclaimed, allocstall, pressure),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	scanned)
+		__field(	unsigned long,	reclaimed)
+		__field(	unsigned long,	allocstall)
+		__field(	int,		pressure)
+	),
+
+	TP_fast_assign(
+		__entry->scanned = scanned;
+		__entry->reclaimed = reclaimed;
+		__entry->allocstall = allocstall;
+		__entry->pressure = pressure;
+	),
+
+	TP_printk("scanned=%lu reclaimed=%lu allocstall=%lu pressure=%d",
+		__entry->scanned, __entry->reclaimed, __entry->allocstall,
+		__entry->pressure)
+);
+
+TRACE_EVENT(lowmem_kill,
+
+	TP_PROTO(struct task_struct *task, int tasksize, int min_score_adj,
+		 unsigned int mode, int pressure),
+
+	TP_ARGS(task, tasksize, min_score_adj, mode, pressure),
+
+	TP_STRUCT__entry(
+		__field(	pid_t,		pid)
+		__array(	char,		comm,	TASK_COMM_LEN )
+		__field(	int,		oom_score_adj)
+		__field(	int,		tasksize)
+		__field(	int,		min_score_adj)
+		__field(	unsigned int,	mode)
+		__field(	int,		pressure)
+	),
+
+	TP_fast_assign(
+		__entry->pid = task->pid;
+		memcpy(__entry->comm, task->comm, TASK_COMM_LEN);
+		__entry->oom_score_adj = task->signal->oom_score_adj;
+		__entry->tasksize = tasksize;
+		__entry->min_score_adj = min_score_adj;
+		__entry->mode = mode;
+		__entry->pressure = pressure;
+	),
+
+	TP_printk("pid=%d comm=%s oom_score_adj=%d size=%d min_score_adj=%d mode=%u pressure=%d",
+		__entry->pid, __entry->comm, __entry->oom_score_adj,
+		__entry->tasksize, __entry->min_score_adj, __entry->mode,
+		__entry->pressure)
+);
+
+#endif
+
+#include <trace/define_trace.h>
@@ -222,6 +222,7 @@ void __init fork_init(unsigned long mempages)
 
 	
 	arch_task_cache_init();
+	oom_adj_index_init();
 
 	max_threads = mempages / (8 * THREAD_SIZE / PAGE_SIZE);
 
@@ -1069,6 +1070,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	copy_flags(clone_flags, p);
 	INIT_LIST_HEAD(&p->children);
 	INIT_LIST_HEAD(&p->sibling);
+#ifdef CONFIG_OOM_SCORE_ADJ_INDEX
+	p->oom_adj_node.pprev = NULL;
+#endif
 	rcu_copy_process(p);
 	p->vfork_done = NULL;
 	spin_lock_init(&p->alloc_lock);
@@ -1286,6 +1290,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 			attach_pid(p, PIDTYPE_SID, task_session(current));
 			list_add_tail(&p->sibling, &p->real_parent->children);
 			list_add_tail_rcu(&p->tasks, &init_task.tasks);
+			oom_adj_index_add(p);
 			__this_cpu_inc(process_counts);
 		}
 		attach_pid(p, PIDTYPE_PID, pid);
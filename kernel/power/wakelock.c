@@ -44,7 +44,14 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
+/*
+ * Active locks without a timeout come first, followed by the ones with a
+ * timeout in order of expiry. The counts let has_wake_lock() answer
+ * without walking the list.
+ */
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+static int active_count[WAKE_LOCK_TYPE_COUNT];
+static int active_untimed_count[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 static int suspend_sys_sync_count;
 static DEFINE_SPINLOCK(suspend_sys_sync_lock);
@@ -202,13 +209,45 @@ static void update_sleep_wait_stats_locked(int done)
 #endif
 
 
+static void wake_lock_list_del_locked(struct wake_lock *lock)
+{
+	int type = lock->flags & WAKE_LOCK_TYPE_MASK;
+
+	if (lock->flags & WAKE_LOCK_ACTIVE) {
+		active_count[type]--;
+		if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE))
+			active_untimed_count[type]--;
+	}
+	list_del(&lock->link);
+}
+
+static void wake_lock_add_timed_locked(struct wake_lock *lock, int type)
+{
+	struct wake_lock *pos;
+
+	list_for_each_entry_reverse(pos, &active_wake_locks[type], link) {
+		if (!(pos->flags & WAKE_LOCK_AUTO_EXPIRE) ||
+		    !time_after(pos->expires, lock->expires))
+			break;
+	}
+	list_add(&lock->link, &pos->link);
+	active_count[type]++;
+}
+
+static void wake_lock_add_untimed_locked(struct wake_lock *lock, int type)
+{
+	list_add(&lock->link, &active_wake_locks[type]);
+	active_count[type]++;
+	active_untimed_count[type]++;
+}
+
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	wake_lock_list_del_locked(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
 	if (debug_mask & (DEBUG_WAKE_LOCK | DEBUG_EXPIRE))
 		pr_info("expired wake lock %s\n", lock->name);
@@ -265,27 +304,31 @@ void htc_print_active_wake_locks(int type)
 
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct list_head *head = &active_wake_locks[type];
+	struct wake_lock *lock;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	if (active_untimed_count[type])
+		return -1;
+	while (!list_empty(head)) {
+		lock = list_first_entry(head, struct wake_lock, link);
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		expire_wake_lock(lock);
 	}
-	return max_timeout;
+	if (list_empty(head))
+		return 0;
+	lock = list_entry(head->prev, struct wake_lock, link);
+	return lock->expires - jiffies;
 }
 
 long has_wake_lock(int type)
 {
 	long ret;
 	unsigned long irqflags;
+
+	if (!ACCESS_ONCE(active_count[type]))
+		return 0;
 	spin_lock_irqsave(&list_lock, irqflags);
 	ret = has_wake_lock_locked(type);
 	if (ret && (debug_mask & DEBUG_WAKEUP) && type == WAKE_LOCK_SUSPEND)
@@ -495,7 +538,7 @@ void wake_lock_destroy(struct wake_lock *lock)
 				  lock->stat.max_time);
 	}
 #endif
-	list_del(&lock->link);
+	wake_lock_list_del_locked(lock);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_destroy);
@@ -524,13 +567,13 @@ static void wake_lock_internal(
 		lock->stat.last_time = ktime_get();
 	}
 #endif
+	wake_lock_list_del_locked(lock);
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
 		lock->stat.last_time = ktime_get();
 #endif
 	}
-	list_del(&lock->link);
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d, timeout %ld.%03lu\n",
@@ -538,13 +581,13 @@ static void wake_lock_internal(
 				(timeout % HZ) * MSEC_PER_SEC / HZ);
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
-		list_add_tail(&lock->link, &active_wake_locks[type]);
+		wake_lock_add_timed_locked(lock, type);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
-		list_add(&lock->link, &active_wake_locks[type]);
+		wake_lock_add_untimed_locked(lock, type);
 	}
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
@@ -587,19 +630,43 @@ void wake_lock_timeout(struct wake_lock *lock, long timeout)
 }
 EXPORT_SYMBOL(wake_lock_timeout);
 
+/*
+ * Unlocking a lock that is not held only retries suspend when no suspend
+ * lock is active, as unlocking any lock always did. Such calls are common
+ * enough not to take list_lock for them: a count that is only held up by
+ * expired locks is dealt with by expire_timer.
+ */
+static void wake_unlock_inactive(struct wake_lock *lock)
+{
+	if ((lock->flags & WAKE_LOCK_TYPE_MASK) == WAKE_LOCK_SUSPEND &&
+	    !ACCESS_ONCE(active_count[WAKE_LOCK_SUSPEND]))
+		queue_work(suspend_work_queue, &suspend_work);
+}
+
 void wake_unlock(struct wake_lock *lock)
 {
 	int type;
 	unsigned long irqflags;
+
+	/* A wake_lock() racing with this is ordered after it */
+	if (!(ACCESS_ONCE(lock->flags) & WAKE_LOCK_ACTIVE)) {
+		wake_unlock_inactive(lock);
+		return;
+	}
 	spin_lock_irqsave(&list_lock, irqflags);
+	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
+		spin_unlock_irqrestore(&list_lock, irqflags);
+		wake_unlock_inactive(lock);
+		return;
+	}
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 0);
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	wake_lock_list_del_locked(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
 	if (type == WAKE_LOCK_SUSPEND) {
 		long has_lock = has_wake_lock_locked(type);
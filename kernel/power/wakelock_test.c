@@ -0,0 +1,148 @@
+/*
+ * kernel/power/wakelock_test.c - wake lock stress test and benchmark.
+ *
+ * One thread per online cpu hammers wake_lock()/wake_unlock() for a few
+ * seconds and the combined throughput is reported.  By default every
+ * thread has a lock of its own, which measures the cost of the shared
+ * bookkeeping; with shared=1 they all fight over one lock.  Each
+ * iteration also takes a timed lock and releases a lock that is never
+ * held, so the timed list and the no-op unlock path get exercised too.
+ * A lock of the test's own is held throughout, so that those unlocks
+ * never find the device free to suspend.
+ *
+ * This file is released under the GPLv2.
+ */
+
+#include <linux/cpu.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/wakelock.h>
+
+static int duration = 5;
+module_param(duration, int, 0);
+MODULE_PARM_DESC(duration, "Length of the test in seconds");
+
+static bool shared;
+module_param(shared, bool, 0);
+MODULE_PARM_DESC(shared, "Use one lock for all threads");
+
+struct wakelock_test_thread {
+	struct task_struct *task;
+	struct wake_lock lock;
+	struct wake_lock idle;
+	struct wake_lock *target;
+	char name[32];
+	char idle_name[40];
+	unsigned long ops;
+};
+
+static int wakelock_test_fn(void *data)
+{
+	struct wakelock_test_thread *t = data;
+	unsigned long ops = 0;
+
+	while (!kthread_should_stop()) {
+		wake_lock(t->target);
+		wake_unlock(t->target);
+		wake_lock_timeout(t->target, HZ);
+		wake_unlock(t->target);
+		/* never held: must not change anything */
+		wake_unlock(&t->idle);
+		ops += 5;
+		if (!(ops & 1023))
+			cond_resched();
+	}
+	t->ops = ops;
+	return 0;
+}
+
+static int __init wakelock_test_init(void)
+{
+	struct wakelock_test_thread *threads;
+	struct wake_lock hold;
+	unsigned long total = 0;
+	int nr = 0, cpu, i;
+	int err = 0;
+
+	if (duration < 1)
+		return -EINVAL;
+
+	threads = kcalloc(num_possible_cpus(), sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	wake_lock_init(&hold, WAKE_LOCK_SUSPEND, "wakelock_test");
+	wake_lock(&hold);
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		struct wakelock_test_thread *t = &threads[nr];
+
+		snprintf(t->name, sizeof(t->name), "wakelock_test%d", cpu);
+		snprintf(t->idle_name, sizeof(t->idle_name),
+			 "wakelock_test%d_idle", cpu);
+		wake_lock_init(&t->lock, WAKE_LOCK_SUSPEND, t->name);
+		wake_lock_init(&t->idle, WAKE_LOCK_SUSPEND, t->idle_name);
+		t->target = shared ? &threads[0].lock : &t->lock;
+		t->task = kthread_create(wakelock_test_fn, t, t->name);
+		if (IS_ERR(t->task)) {
+			err = PTR_ERR(t->task);
+			wake_lock_destroy(&t->idle);
+			wake_lock_destroy(&t->lock);
+			break;
+		}
+		kthread_bind(t->task, cpu);
+		nr++;
+	}
+
+	if (!err) {
+		for (i = 0; i < nr; i++)
+			wake_up_process(threads[i].task);
+		schedule_timeout_interruptible(duration * HZ);
+	}
+
+	for (i = 0; i < nr; i++)
+		kthread_stop(threads[i].task);
+	put_online_cpus();
+
+	for (i = 0; i < nr; i++) {
+		struct wakelock_test_thread *t = &threads[i];
+
+		if (wake_lock_active(&t->lock) || wake_lock_active(&t->idle)) {
+			pr_err("wakelock_test: %s left active\n", t->name);
+			err = -EIO;
+		}
+		if (!err)
+			pr_info("wakelock_test: %s: %lu ops/sec\n", t->name,
+				t->ops / duration);
+		total += t->ops;
+	}
+	for (i = 0; i < nr; i++) {
+		wake_lock_destroy(&threads[i].idle);
+		wake_lock_destroy(&threads[i].lock);
+	}
+	kfree(threads);
+	wake_unlock(&hold);
+	wake_lock_destroy(&hold);
+
+	if (err)
+		return err;
+	pr_info("wakelock_test: %d threads, %s lock%s: %lu ops/sec\n", nr,
+		shared ? "one shared" : "per-thread", shared ? "" : "s",
+		total / duration);
+
+	/* We intentionally return -EAGAIN to prevent keeping the module,
+	 * as the test has already run and there is nothing left to do. */
+	return -EAGAIN;
+}
+
+static void __exit wakelock_test_exit(void) { }
+
+module_init(wakelock_test_init);
+module_exit(wakelock_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Wake lock stress test");
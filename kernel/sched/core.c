@@ -1238,11 +1238,44 @@ static void ttwu_queue(struct task_struct *p, int cpu)
 	raw_spin_unlock(&rq->lock);
 }
 
+static ATOMIC_NOTIFIER_HEAD(sched_wakeup_notifier_head);
+
+/*
+ * Lets cpufreq governors react to new runnable load when it appears,
+ * rather than at their next sample. Notifiers run in the waker's context,
+ * which may be atomic, with no scheduler locks held; they may wake up
+ * tasks themselves.
+ */
+int sched_wakeup_notifier_register(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&sched_wakeup_notifier_head, nb);
+}
+EXPORT_SYMBOL_GPL(sched_wakeup_notifier_register);
+
+int sched_wakeup_notifier_unregister(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&sched_wakeup_notifier_head,
+						nb);
+}
+EXPORT_SYMBOL_GPL(sched_wakeup_notifier_unregister);
+
+static inline void sched_wakeup_notify(int src_cpu, int dest_cpu)
+{
+	struct sched_wakeup_notify_data data;
+
+	if (likely(!rcu_access_pointer(sched_wakeup_notifier_head.head)))
+		return;
+	data.src_cpu = src_cpu;
+	data.dest_cpu = dest_cpu;
+	data.nr_running = ACCESS_ONCE(cpu_rq(dest_cpu)->nr_running);
+	atomic_notifier_call_chain(&sched_wakeup_notifier_head, 0, &data);
+}
+
 static int
 try_to_wake_up(struct task_struct *p, unsigned int state, int wake_flags)
 {
 	unsigned long flags;
-	int cpu, success = 0;
+	int cpu, src_cpu, success = 0, queued = 0;
 
 	smp_wmb();
 	raw_spin_lock_irqsave(&p->pi_lock, flags);
@@ -1250,7 +1283,7 @@ try_to_wake_up(struct task_struct *p, unsigned int state, int wake_flags)
 		goto out;
 
 	success = 1; 
-	cpu = task_cpu(p);
+	cpu = src_cpu = task_cpu(p);
 
 	if (p->on_rq && ttwu_remote(p, wake_flags))
 		goto stat;
@@ -1280,11 +1313,14 @@ try_to_wake_up(struct task_struct *p, unsigned int state, int wake_flags)
 #endif 
 
 	ttwu_queue(p, cpu);
+	queued = 1;
 stat:
 	ttwu_stat(p, cpu, wake_flags);
 out:
 	raw_spin_unlock_irqrestore(&p->pi_lock, flags);
 
+	if (queued)
+		sched_wakeup_notify(src_cpu, cpu);
 	return success;
 }
 
@@ -1404,6 +1440,7 @@ void wake_up_new_task(struct task_struct *p)
 {
 	unsigned long flags;
 	struct rq *rq;
+	int src_cpu = task_cpu(p);
 
 	raw_spin_lock_irqsave(&p->pi_lock, flags);
 #ifdef CONFIG_SMP
@@ -1420,6 +1457,7 @@ void wake_up_new_task(struct task_struct *p)
 		p->sched_class->task_woken(rq, p);
 #endif
 	task_rq_unlock(rq, p, &flags);
+	sched_wakeup_notify(src_cpu, task_cpu(p));
 }
 
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -0,0 +1,145 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ *
+ * Greedy single-pass compressor producing the LZ4 block format: a
+ * sequence is a token (literal run length in the high nibble, match
+ * length minus MINMATCH in the low nibble), optional length extension
+ * bytes, the literals, a 16-bit little endian match offset and optional
+ * match length extension bytes. The last sequence carries literals only.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return LZ4_HASH_VALUE(get_unaligned((const u32 *)p));
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+/* Worst case output for a literal run: token, extension bytes, literals */
+static inline size_t lz4_literal_bound(size_t len)
+{
+	return 1 + len + len / 255 + 1;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *const iend = src + src_len;
+	const unsigned char *const mflimit = iend - MFLIMIT;
+	const unsigned char *const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *const oend = dst + *dst_len;
+	unsigned char *token;
+	const unsigned char *ref;
+	size_t lit_len, match_len;
+	unsigned int misses = 0;
+	u32 h;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+
+	while (ip <= mflimit) {
+		h = lz4_hash(ip);
+		ref = src + hash_table[h];
+		hash_table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_DISTANCE ||
+		    get_unaligned((const u32 *)ref) !=
+		    get_unaligned((const u32 *)ip)) {
+			ip += 1 + (misses++ >> SKIP_TRIGGER);
+			continue;
+		}
+		misses = 0;
+
+		/* Extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* Literal run */
+		lit_len = ip - anchor;
+		if (unlikely(lz4_literal_bound(lit_len) + 2 > oend - op))
+			return -1;
+		token = op++;
+		if (lit_len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, lit_len - RUN_MASK);
+		} else {
+			*token = lit_len << ML_BITS;
+		}
+		memcpy(op, anchor, lit_len);
+		op += lit_len;
+
+		/* Offset */
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* Match length; the last LASTLITERALS bytes stay literals */
+		ip += MINMATCH;
+		ref += MINMATCH;
+		anchor = ip;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+		match_len = ip - anchor;
+		if (match_len >= ML_MASK) {
+			if (unlikely(match_len / 255 + 1 > oend - op))
+				return -1;
+			*token += ML_MASK;
+			op = lz4_put_length(op, match_len - ML_MASK);
+		} else {
+			*token += match_len;
+		}
+		anchor = ip;
+
+		if (ip > mflimit)
+			break;
+		/* Index a position inside the match for the next search */
+		hash_table[lz4_hash(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	lit_len = iend - anchor;
+	if (unlikely(lz4_literal_bound(lit_len) > oend - op))
+		return -1;
+	token = op++;
+	if (lit_len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit_len - RUN_MASK);
+	} else {
+		*token = lit_len << ML_BITS;
+	}
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
@@ -0,0 +1,93 @@
+/*
+ * LZ4 Decompressor
+ *
+ * Bounds checked against both the input and the output buffer, so it is
+ * safe to use on untrusted data.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline int lz4_get_length(const unsigned char **ip,
+				 const unsigned char *iend, size_t *len)
+{
+	unsigned char s;
+
+	do {
+		if (unlikely(*ip >= iend))
+			return -1;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+
+	return 0;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char *const iend = src + src_len;
+	unsigned char *op = dest;
+	unsigned char *const oend = dest + *dest_len;
+	const unsigned char *ref;
+	unsigned int token;
+	size_t len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* Literals */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && lz4_get_length(&ip, iend, &len))
+			return -1;
+		if (unlikely(len > iend - ip || len > oend - op))
+			return -1;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence ends with its literals */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			return -1;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > op - dest))
+			return -1;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && lz4_get_length(&ip, iend, &len))
+			return -1;
+		len += MINMATCH;
+		if (unlikely(len > oend - op))
+			return -1;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* Overlapping match repeats the last offset bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dest_len = op - dest;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
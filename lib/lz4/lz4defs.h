@@ -0,0 +1,24 @@
+/*
+ * lz4defs.h -- architecture specific defines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+#define COPYLENGTH	8
+#define LASTLITERALS	5
+#define MFLIMIT		(COPYLENGTH + MINMATCH)
+
+#define MAX_DISTANCE	((1 << 16) - 1)
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/* Number of misses after which the match search speeds up its stride */
+#define SKIP_TRIGGER	6
+
+#define LZ4_HASH_VALUE(seq) \
+	(((seq) * 2654435761U) >> ((MINMATCH * 8) - LZ4_HASH_LOG))
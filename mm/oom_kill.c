@@ -35,6 +35,7 @@
 #include <linux/freezer.h>
 #include <linux/ftrace.h>
 #include <linux/ratelimit.h>
+#include <linux/rculist_nulls.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/oom.h>
@@ -61,6 +62,7 @@ void compare_swap_oom_score_adj(int old_val, int new_val)
 	if (current->signal->oom_score_adj == old_val)
 		current->signal->oom_score_adj = new_val;
 	trace_oom_score_adj_update(current);
+	oom_adj_index_update(current);
 	spin_unlock_irq(&sighand->siglock);
 }
 
@@ -81,11 +83,88 @@ int test_set_oom_score_adj(int new_val)
 	old_val = current->signal->oom_score_adj;
 	current->signal->oom_score_adj = new_val;
 	trace_oom_score_adj_update(current);
+	oom_adj_index_update(current);
 	spin_unlock_irq(&sighand->siglock);
 
 	return old_val;
 }
 
+#ifdef CONFIG_OOM_SCORE_ADJ_INDEX
+/*
+ * Thread group leaders hashed by oom_score_adj, so that the low memory
+ * killer can look at the highest buckets first instead of walking every
+ * process.  Readers walk the buckets under rcu_read_lock().  A leader is
+ * moved between buckets without waiting for readers, so a reader can
+ * follow it into another bucket; each bucket ends in a nulls marker
+ * holding its index, and a reader that ends up on the wrong marker must
+ * restart the bucket.  Moves happen under the group's siglock, which also
+ * covers the hand-over to a new leader in de_thread().
+ */
+struct hlist_nulls_head oom_adj_index[OOM_ADJ_INDEX_BUCKETS];
+static DEFINE_SPINLOCK(oom_adj_index_lock);
+
+void __init oom_adj_index_init(void)
+{
+	int i;
+
+	for (i = 0; i < OOM_ADJ_INDEX_BUCKETS; i++)
+		INIT_HLIST_NULLS_HEAD(&oom_adj_index[i], i);
+}
+
+void oom_adj_index_add(struct task_struct *p)
+{
+	unsigned long flags;
+	int bucket = oom_adj_index_bucket(p->signal->oom_score_adj);
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	hlist_nulls_add_head_rcu(&p->oom_adj_node, &oom_adj_index[bucket]);
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+void oom_adj_index_del(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	if (!hlist_nulls_unhashed(&p->oom_adj_node))
+		hlist_nulls_del_init_rcu(&p->oom_adj_node);
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+/* Called by de_thread() with the group's siglock held */
+void oom_adj_index_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+	int bucket;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	if (!hlist_nulls_unhashed(&old->oom_adj_node)) {
+		bucket = oom_adj_index_bucket(new->signal->oom_score_adj);
+		hlist_nulls_del_init_rcu(&old->oom_adj_node);
+		hlist_nulls_add_head_rcu(&new->oom_adj_node,
+					 &oom_adj_index[bucket]);
+	}
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+
+/* Called with p's siglock held, after oom_score_adj was changed */
+void oom_adj_index_update(struct task_struct *p)
+{
+	struct task_struct *leader = p->group_leader;
+	unsigned long flags;
+	int bucket;
+
+	spin_lock_irqsave(&oom_adj_index_lock, flags);
+	if (!hlist_nulls_unhashed(&leader->oom_adj_node)) {
+		bucket = oom_adj_index_bucket(p->signal->oom_score_adj);
+		hlist_nulls_del_rcu(&leader->oom_adj_node);
+		hlist_nulls_add_head_rcu(&leader->oom_adj_node,
+					 &oom_adj_index[bucket]);
+	}
+	spin_unlock_irqrestore(&oom_adj_index_lock, flags);
+}
+#endif
+
 #ifdef CONFIG_NUMA
 /**
  * has_intersects_mems_allowed() - check task eligiblity for kill
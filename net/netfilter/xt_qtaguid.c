@@ -16,6 +16,7 @@
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter/xt_qtaguid.h>
 #include <linux/skbuff.h>
+#include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 #include <net/addrconf.h>
 #include <net/sock.h>
@@ -44,6 +45,11 @@ static struct proc_dir_entry *xt_qtaguid_stats_file;
 static unsigned int proc_stats_perms = S_IRUGO;
 module_param_named(stats_perms, proc_stats_perms, uint, S_IRUGO | S_IWUSR);
 
+static struct proc_dir_entry *xt_qtaguid_stats_delta_file;
+static unsigned int proc_stats_delta_perms = S_IRUGO | S_IWUSR;
+module_param_named(stats_delta_perms, proc_stats_delta_perms, uint,
+		   S_IRUGO | S_IWUSR);
+
 static struct proc_dir_entry *xt_qtaguid_ctrl_file;
 #ifdef CONFIG_ANDROID_PARANOID_NETWORK
 static unsigned int proc_ctrl_perms = S_IRUGO | S_IWUGO;
@@ -93,8 +99,14 @@ static DEFINE_SPINLOCK(iface_stat_list_lock);
 
 static struct rb_root sock_tag_tree = RB_ROOT;
 static DEFINE_SPINLOCK(sock_tag_list_lock);
-
-static struct rb_root tag_counter_set_tree = RB_ROOT;
+/* Indexes sock_tag_tree for the packet path; protected as the tree */
+static struct sock_tag_hash __rcu *sock_tag_hash;
+static unsigned int sock_tag_count;
+static bool sock_tag_hash_resizing;
+/* Lets the packet path read a sock_tag.tag that is being retagged */
+static seqcount_t sock_tag_seq = SEQCNT_ZERO;
+
+static struct hlist_head tag_counter_set_hash[1 << TAG_COUNTER_SET_HASH_BITS];
 static DEFINE_SPINLOCK(tag_counter_set_list_lock);
 
 static struct rb_root uid_tag_data_tree = RB_ROOT;
@@ -103,6 +115,18 @@ static DEFINE_SPINLOCK(uid_tag_data_tree_lock);
 static struct rb_root proc_qtu_data_tree = RB_ROOT;
 
 static struct qtaguid_event_counts qtu_events;
+
+/*
+ * Bumped by every stats_delta snapshot. The packet path stamps the
+ * counters it updates with it, so a snapshot can tell which tag_stats
+ * changed since an earlier one.
+ */
+static unsigned long stats_gen = 1;
+/* stats_gen when a tag_stat was last deleted */
+static unsigned long stats_reset_gen;
+static DEFINE_MUTEX(stats_delta_mutex);
+/* Odd while this cpu is updating tag_stat counters */
+static DEFINE_PER_CPU(unsigned int, stats_update_seq);
 static bool can_manipulate_uids(void)
 {
 	
@@ -206,28 +230,81 @@ static void tag_stat_tree_insert(struct tag_stat *data, struct rb_root *root)
 	tag_node_tree_insert(&data->tn, root);
 }
 
-static struct tag_stat *tag_stat_tree_search(struct rb_root *root, tag_t tag)
+static struct tag_stat *tag_stat_hash_search(struct iface_stat *iface_entry,
+					     tag_t tag)
 {
-	struct tag_node *node = tag_node_tree_search(root, tag);
-	if (!node)
-		return NULL;
-	return rb_entry(&node->node, struct tag_stat, tn.node);
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	struct tag_stat *ts;
+
+	head = &iface_entry->tag_stat_hash[tag_hash(tag, TAG_STAT_HASH_BITS)];
+	hlist_for_each_entry_rcu(ts, pos, head, hash_node) {
+		if (ts->tn.tag == tag)
+			return ts;
+	}
+	return NULL;
 }
 
-static void tag_counter_set_tree_insert(struct tag_counter_set *data,
-					struct rb_root *root)
+static void tag_stat_free_rcu(struct rcu_head *head)
 {
-	tag_node_tree_insert(&data->tn, root);
+	struct tag_stat *ts = container_of(head, struct tag_stat, rcu);
+
+	kfree(ts->cpu_counters);
+	kfree(ts);
 }
 
-static struct tag_counter_set *tag_counter_set_tree_search(struct rb_root *root,
-							   tag_t tag)
+static void tag_stat_delete(struct tag_stat *ts, struct iface_stat *iface_entry)
 {
-	struct tag_node *node = tag_node_tree_search(root, tag);
-	if (!node)
-		return NULL;
-	return rb_entry(&node->node, struct tag_counter_set, tn.node);
+	rb_erase(&ts->tn.node, &iface_entry->tag_stat_tree);
+	hlist_del_rcu(&ts->hash_node);
+	call_rcu_bh(&ts->rcu, tag_stat_free_rcu);
+	stats_reset_gen = ACCESS_ONCE(stats_gen);
+}
+
+void tag_stat_get_counters(struct tag_stat *ts, struct data_counters *dc)
+{
+	struct data_counters snap;
+	u64 *sum = (u64 *)dc, *val = (u64 *)&snap;
+	unsigned int start;
+	int cpu, i;
+
+	memset(dc, 0, sizeof(*dc));
+	for_each_possible_cpu(cpu) {
+		struct data_counters_cpu *dcc = &ts->cpu_counters[cpu];
+
+		do {
+			start = u64_stats_fetch_begin_bh(&dcc->syncp);
+			snap = dcc->counters;
+		} while (u64_stats_fetch_retry_bh(&dcc->syncp, start));
+		for (i = 0; i < sizeof(snap) / sizeof(u64); i++)
+			sum[i] += val[i];
+	}
+}
+
+static void tag_counter_set_hash_insert(struct tag_counter_set *data)
+{
+	hlist_add_head_rcu(&data->node,
+		&tag_counter_set_hash[tag_hash(data->tag,
+					       TAG_COUNTER_SET_HASH_BITS)]);
+}
+
+static struct tag_counter_set *tag_counter_set_hash_search(tag_t tag)
+{
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	struct tag_counter_set *tcs;
 
+	head = &tag_counter_set_hash[tag_hash(tag, TAG_COUNTER_SET_HASH_BITS)];
+	hlist_for_each_entry_rcu(tcs, pos, head, node) {
+		if (tcs->tag == tag)
+			return tcs;
+	}
+	return NULL;
+}
+
+static void tag_counter_set_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct tag_counter_set, rcu));
 }
 
 static void tag_ref_tree_insert(struct tag_ref *data, struct rb_root *root)
@@ -243,24 +320,6 @@ static struct tag_ref *tag_ref_tree_search(struct rb_root *root, tag_t tag)
 	return rb_entry(&node->node, struct tag_ref, tn.node);
 }
 
-static struct sock_tag *sock_tag_tree_search(struct rb_root *root,
-					     const struct sock *sk)
-{
-	struct rb_node *node = root->rb_node;
-
-	while (node) {
-		struct sock_tag *data = rb_entry(node, struct sock_tag,
-						 sock_node);
-		if (sk < data->sk)
-			node = node->rb_left;
-		else if (sk > data->sk)
-			node = node->rb_right;
-		else
-			return data;
-	}
-	return NULL;
-}
-
 static void sock_tag_tree_insert(struct sock_tag *data, struct rb_root *root)
 {
 	struct rb_node **new = &(root->rb_node), *parent = NULL;
@@ -283,6 +342,112 @@ static void sock_tag_tree_insert(struct sock_tag *data, struct rb_root *root)
 	rb_insert_color(&data->sock_node, root);
 }
 
+static struct sock_tag_hash *sock_tag_hash_alloc(unsigned int bits,
+						  gfp_t gfp)
+{
+	struct sock_tag_hash *ht;
+
+	ht = kzalloc(sizeof(*ht) + (sizeof(struct hlist_head) << bits), gfp);
+	if (ht)
+		ht->bits = bits;
+	return ht;
+}
+
+static inline struct sock_tag_hash *sock_tag_hash_table(void)
+{
+	return rcu_dereference_check(sock_tag_hash,
+				     rcu_read_lock_bh_held() ||
+				     lockdep_is_held(&sock_tag_list_lock));
+}
+
+static inline struct sock_tag *sock_tag_from_hash_node(struct hlist_node *pos,
+							unsigned int idx)
+{
+	if (idx)
+		return hlist_entry(pos, struct sock_tag, hash_node[1]);
+	return hlist_entry(pos, struct sock_tag, hash_node[0]);
+}
+
+static struct sock_tag *sock_tag_hash_search(const struct sock *sk)
+{
+	struct sock_tag_hash *ht = sock_tag_hash_table();
+	struct hlist_node *pos;
+	struct sock_tag *st;
+
+	pos = rcu_dereference_raw(hlist_first_rcu(
+				&ht->heads[hash_ptr((void *)sk, ht->bits)]));
+	while (pos) {
+		st = sock_tag_from_hash_node(pos, ht->idx);
+		if (st->sk == sk)
+			return st;
+		pos = rcu_dereference_raw(hlist_next_rcu(pos));
+	}
+	return NULL;
+}
+
+static void sock_tag_hash_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct sock_tag_hash, rcu));
+	sock_tag_hash_resizing = false;
+}
+
+/*
+ * Called with sock_tag_list_lock held. Every entry is linked into the new
+ * table through the hash node the old table does not use, then the new
+ * table is published. Readers that picked up the old table can keep
+ * walking it until the grace period ends, so only one resize may be in
+ * flight at a time.
+ */
+static void sock_tag_hash_grow(struct sock_tag_hash *old)
+{
+	struct sock_tag_hash *new;
+	struct rb_node *node;
+	struct sock_tag *st;
+
+	new = sock_tag_hash_alloc(old->bits + 1, GFP_ATOMIC | __GFP_NOWARN);
+	if (!new)
+		return;
+	new->idx = !old->idx;
+	for (node = rb_first(&sock_tag_tree); node; node = rb_next(node)) {
+		st = rb_entry(node, struct sock_tag, sock_node);
+		hlist_add_head_rcu(&st->hash_node[new->idx],
+				   &new->heads[hash_ptr(st->sk, new->bits)]);
+	}
+	sock_tag_hash_resizing = true;
+	rcu_assign_pointer(sock_tag_hash, new);
+	call_rcu_bh(&old->rcu, sock_tag_hash_free_rcu);
+	CT_DEBUG("qtaguid: %s(): %u sock tags, %u buckets\n", __func__,
+		 sock_tag_count, 1 << new->bits);
+}
+
+/* Both called with sock_tag_list_lock held */
+static void sock_tag_add(struct sock_tag *st)
+{
+	struct sock_tag_hash *ht = sock_tag_hash_table();
+
+	sock_tag_tree_insert(st, &sock_tag_tree);
+	hlist_add_head_rcu(&st->hash_node[ht->idx],
+			   &ht->heads[hash_ptr(st->sk, ht->bits)]);
+	sock_tag_count++;
+	if (sock_tag_count > (2U << ht->bits) &&
+	    ht->bits < SOCK_TAG_HASH_MAX_BITS && !sock_tag_hash_resizing)
+		sock_tag_hash_grow(ht);
+}
+
+static void sock_tag_del(struct sock_tag *st)
+{
+	struct sock_tag_hash *ht = sock_tag_hash_table();
+
+	rb_erase(&st->sock_node, &sock_tag_tree);
+	hlist_del_rcu(&st->hash_node[ht->idx]);
+	sock_tag_count--;
+}
+
+static void sock_tag_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct sock_tag, rcu));
+}
+
 static void sock_tag_tree_erase(struct rb_root *st_to_free_tree)
 {
 	struct rb_node *node;
@@ -299,7 +464,7 @@ static void sock_tag_tree_erase(struct rb_root *st_to_free_tree)
 			 get_uid_from_tag(st_entry->tag));
 		rb_erase(&st_entry->sock_node, st_to_free_tree);
 		sockfd_put(st_entry->socket);
-		kfree(st_entry);
+		call_rcu_bh(&st_entry->rcu, sock_tag_free_rcu);
 	}
 }
 
@@ -604,11 +769,11 @@ static int get_active_counter_set(tag_t tag)
 		 tag, get_uid_from_tag(tag));
 	
 	tag = get_utag_from_tag(tag);
-	spin_lock_bh(&tag_counter_set_list_lock);
-	tcs = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
+	rcu_read_lock_bh();
+	tcs = tag_counter_set_hash_search(tag);
 	if (tcs)
 		active_set = tcs->active_set;
-	spin_unlock_bh(&tag_counter_set_list_lock);
+	rcu_read_unlock_bh();
 	return active_set;
 }
 
@@ -623,7 +788,7 @@ static struct iface_stat *get_iface_entry(const char *ifname)
 	}
 
 	
-	list_for_each_entry(iface_entry, &iface_stat_list, list) {
+	list_for_each_entry_rcu(iface_entry, &iface_stat_list, list) {
 		if (!strcmp(ifname, iface_entry->ifname))
 			goto done;
 	}
@@ -643,6 +808,7 @@ static int iface_stat_fmt_proc_read(char *page, char **num_items_returned,
 	struct iface_stat *iface_entry;
 	struct rtnl_link_stats64 dev_stats, *stats;
 	struct rtnl_link_stats64 no_dev_stats = {0};
+	struct byte_packet_counters skb_totals[IFS_MAX_DIRECTIONS];
 
 	if (unlikely(module_passive)) {
 		*eof = 1;
@@ -702,15 +868,16 @@ static int iface_stat_fmt_proc_read(char *page, char **num_items_returned,
 				stats->tx_bytes, stats->tx_packets
 				);
 		} else {
+			iface_stat_get_skb_totals(iface_entry, skb_totals);
 			len = snprintf(
 				outp, char_count,
 				"%s "
 				"%llu %llu %llu %llu\n",
 				iface_entry->ifname,
-				iface_entry->totals_via_skb[IFS_RX].bytes,
-				iface_entry->totals_via_skb[IFS_RX].packets,
-				iface_entry->totals_via_skb[IFS_TX].bytes,
-				iface_entry->totals_via_skb[IFS_TX].packets
+				skb_totals[IFS_RX].bytes,
+				skb_totals[IFS_RX].packets,
+				skb_totals[IFS_TX].bytes,
+				skb_totals[IFS_TX].packets
 				);
 		}
 		if (len >= char_count) {
@@ -805,6 +972,16 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		kfree(new_iface);
 		return NULL;
 	}
+	new_iface->totals_via_skb = kzalloc(nr_cpu_ids *
+					    sizeof(*new_iface->totals_via_skb),
+					    GFP_ATOMIC);
+	if (new_iface->totals_via_skb == NULL) {
+		pr_err("qtaguid: iface_stat: create(%s): "
+		       "counters alloc failed\n", net_dev->name);
+		kfree(new_iface->ifname);
+		kfree(new_iface);
+		return NULL;
+	}
 	spin_lock_init(&new_iface->tag_stat_list_lock);
 	new_iface->tag_stat_tree = RB_ROOT;
 	_iface_stat_set_active(new_iface, net_dev, true);
@@ -814,6 +991,7 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		pr_err("qtaguid: iface_stat: create(%s): "
 		       "work alloc failed\n", new_iface->ifname);
 		_iface_stat_set_active(new_iface, net_dev, false);
+		kfree(new_iface->totals_via_skb);
 		kfree(new_iface->ifname);
 		kfree(new_iface);
 		return NULL;
@@ -821,7 +999,8 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 	isw->iface_entry = new_iface;
 	INIT_WORK(&isw->iface_work, iface_create_proc_worker);
 	schedule_work(&isw->iface_work);
-	list_add(&new_iface->list, &iface_stat_list);
+	/* Entries are never removed, the packet path walks the list locklessly */
+	list_add_rcu(&new_iface->list, &iface_stat_list);
 	return new_iface;
 }
 
@@ -1005,19 +1184,30 @@ done_put:
 static struct sock_tag *get_sock_stat_nl(const struct sock *sk)
 {
 	MT_DEBUG("qtaguid: get_sock_stat_nl(sk=%p)\n", sk);
-	return sock_tag_tree_search(&sock_tag_tree, sk);
+	return sock_tag_hash_search(sk);
 }
 
-static struct sock_tag *get_sock_stat(const struct sock *sk)
+/* Copies the tag out, the entry may go away once rcu is unlocked */
+static bool get_sock_tag(const struct sock *sk, tag_t *tag)
 {
 	struct sock_tag *sock_tag_entry;
-	MT_DEBUG("qtaguid: get_sock_stat(sk=%p)\n", sk);
+	unsigned int seq;
+	bool found = false;
+
+	MT_DEBUG("qtaguid: get_sock_tag(sk=%p)\n", sk);
 	if (!sk)
-		return NULL;
-	spin_lock_bh(&sock_tag_list_lock);
-	sock_tag_entry = get_sock_stat_nl(sk);
-	spin_unlock_bh(&sock_tag_list_lock);
-	return sock_tag_entry;
+		return false;
+	rcu_read_lock_bh();
+	sock_tag_entry = sock_tag_hash_search(sk);
+	if (sock_tag_entry) {
+		do {
+			seq = read_seqcount_begin(&sock_tag_seq);
+			*tag = sock_tag_entry->tag;
+		} while (read_seqcount_retry(&sock_tag_seq, seq));
+		found = true;
+	}
+	rcu_read_unlock_bh();
+	return found;
 }
 
 static int ipx_proto(const struct sk_buff *skb,
@@ -1113,6 +1303,7 @@ static void iface_stat_update_from_skb(const struct sk_buff *skb,
 				       struct xt_action_param *par)
 {
 	struct iface_stat *entry;
+	struct iface_skb_counters *skb_cnt;
 	const struct net_device *el_dev;
 	enum ifs_tx_rx direction = par->in ? IFS_RX : IFS_TX;
 	int bytes = skb->len;
@@ -1147,23 +1338,64 @@ static void iface_stat_update_from_skb(const struct sk_buff *skb,
 			 par->family, proto);
 	}
 
-	spin_lock_bh(&iface_stat_list_lock);
+	rcu_read_lock_bh();
 	entry = get_iface_entry(el_dev->name);
 	if (entry == NULL) {
 		IF_DEBUG("qtaguid: iface_stat: %s(%s): not tracked\n",
 			 __func__, el_dev->name);
-		spin_unlock_bh(&iface_stat_list_lock);
+		rcu_read_unlock_bh();
 		return;
 	}
 
 	IF_DEBUG("qtaguid: %s(%s): entry=%p\n", __func__,
 		 el_dev->name, entry);
 
-	entry->totals_via_skb[direction].bytes += bytes;
-	entry->totals_via_skb[direction].packets++;
-	spin_unlock_bh(&iface_stat_list_lock);
+	skb_cnt = &entry->totals_via_skb[smp_processor_id()];
+	u64_stats_update_begin(&skb_cnt->syncp);
+	skb_cnt->totals[direction].bytes += bytes;
+	skb_cnt->totals[direction].packets++;
+	u64_stats_update_end(&skb_cnt->syncp);
+	rcu_read_unlock_bh();
+}
+
+void iface_stat_get_skb_totals(struct iface_stat *iface,
+			       struct byte_packet_counters *totals)
+{
+	struct byte_packet_counters snap[IFS_MAX_DIRECTIONS];
+	unsigned int start;
+	int cpu, dir;
+
+	memset(totals, 0, sizeof(snap));
+	for_each_possible_cpu(cpu) {
+		struct iface_skb_counters *skb_cnt =
+			&iface->totals_via_skb[cpu];
+
+		do {
+			start = u64_stats_fetch_begin_bh(&skb_cnt->syncp);
+			memcpy(snap, skb_cnt->totals, sizeof(snap));
+		} while (u64_stats_fetch_retry_bh(&skb_cnt->syncp, start));
+		for (dir = 0; dir < IFS_MAX_DIRECTIONS; dir++) {
+			totals[dir].bytes += snap[dir].bytes;
+			totals[dir].packets += snap[dir].packets;
+		}
+	}
 }
 
+static void tag_stat_counters_update(struct tag_stat *tag_entry,
+				     int active_set, enum ifs_tx_rx direction,
+				     int proto, int bytes)
+{
+	struct data_counters_cpu *dcc;
+
+	dcc = &tag_entry->cpu_counters[smp_processor_id()];
+	u64_stats_update_begin(&dcc->syncp);
+	data_counters_update(&dcc->counters, active_set, direction,
+			     proto, bytes);
+	u64_stats_update_end(&dcc->syncp);
+	dcc->gen = ACCESS_ONCE(stats_gen);
+}
+
+/* Called with bh disabled */
 static void tag_stat_update(struct tag_stat *tag_entry,
 			enum ifs_tx_rx direction, int proto, int bytes)
 {
@@ -1173,15 +1405,21 @@ static void tag_stat_update(struct tag_stat *tag_entry,
 		 "dir=%d proto=%d bytes=%d)\n",
 		 tag_entry->tn.tag, get_uid_from_tag(tag_entry->tn.tag),
 		 active_set, direction, proto, bytes);
-	data_counters_update(&tag_entry->counters, active_set, direction,
-			     proto, bytes);
-	if (tag_entry->parent_counters)
-		data_counters_update(tag_entry->parent_counters, active_set,
-				     direction, proto, bytes);
-}
-
+	/* Pairs with stats_delta_wait_updates() */
+	__this_cpu_inc(stats_update_seq);
+	smp_mb();
+	tag_stat_counters_update(tag_entry, active_set, direction,
+				 proto, bytes);
+	if (tag_entry->parent)
+		tag_stat_counters_update(tag_entry->parent, active_set,
+					 direction, proto, bytes);
+	smp_wmb();
+	__this_cpu_inc(stats_update_seq);
+}
+
+/* Called with the iface_entry's tag_stat_list_lock held */
 static struct tag_stat *create_if_tag_stat(struct iface_stat *iface_entry,
-					   tag_t tag)
+					   tag_t tag, struct tag_stat *parent)
 {
 	struct tag_stat *new_tag_stat_entry = NULL;
 	IF_DEBUG("qtaguid: iface_stat: %s(): ife=%p tag=0x%llx"
@@ -1192,8 +1430,21 @@ static struct tag_stat *create_if_tag_stat(struct iface_stat *iface_entry,
 		pr_err("qtaguid: iface_stat: tag stat alloc failed\n");
 		goto done;
 	}
+	new_tag_stat_entry->cpu_counters =
+		kzalloc(nr_cpu_ids * sizeof(struct data_counters_cpu),
+			GFP_ATOMIC);
+	if (!new_tag_stat_entry->cpu_counters) {
+		pr_err("qtaguid: iface_stat: tag stat counters alloc failed\n");
+		kfree(new_tag_stat_entry);
+		new_tag_stat_entry = NULL;
+		goto done;
+	}
 	new_tag_stat_entry->tn.tag = tag;
+	new_tag_stat_entry->parent = parent;
 	tag_stat_tree_insert(new_tag_stat_entry, &iface_entry->tag_stat_tree);
+	hlist_add_head_rcu(&new_tag_stat_entry->hash_node,
+			   &iface_entry->tag_stat_hash[tag_hash(tag,
+						TAG_STAT_HASH_BITS)]);
 done:
 	return new_tag_stat_entry;
 }
@@ -1205,29 +1456,24 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 	struct tag_stat *tag_stat_entry;
 	tag_t tag, acct_tag;
 	tag_t uid_tag;
-	struct data_counters *uid_tag_counters;
-	struct sock_tag *sock_tag_entry;
+	struct tag_stat *uid_tag_stat;
 	struct iface_stat *iface_entry;
-	struct tag_stat *new_tag_stat = NULL;
 	MT_DEBUG("qtaguid: if_tag_stat_update(ifname=%s "
 		"uid=%u sk=%p dir=%d proto=%d bytes=%d)\n",
 		 ifname, uid, sk, direction, proto, bytes);
 
-
+	rcu_read_lock_bh();
 	iface_entry = get_iface_entry(ifname);
 	if (!iface_entry) {
 		pr_err("qtaguid: iface_stat: stat_update() %s not found\n",
 		       ifname);
-		return;
+		goto unlock;
 	}
-	
 
 	MT_DEBUG("qtaguid: iface_stat: stat_update() dev=%s entry=%p\n",
 		 ifname, iface_entry);
 
-	sock_tag_entry = get_sock_stat(sk);
-	if (sock_tag_entry) {
-		tag = sock_tag_entry->tag;
+	if (get_sock_tag(sk, &tag)) {
 		acct_tag = get_atag_from_tag(tag);
 		uid_tag = get_utag_from_tag(tag);
 	} else {
@@ -1238,37 +1484,40 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 	MT_DEBUG("qtaguid: iface_stat: stat_update(): "
 		 " looking for tag=0x%llx (uid=%u) in ife=%p\n",
 		 tag, get_uid_from_tag(tag), iface_entry);
-	
-	spin_lock_bh(&iface_entry->tag_stat_list_lock);
 
-	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
-					      tag);
+	tag_stat_entry = tag_stat_hash_search(iface_entry, tag);
 	if (tag_stat_entry) {
 		tag_stat_update(tag_stat_entry, direction, proto, bytes);
-		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
-		return;
+		goto unlock;
 	}
 
-	
-	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
-					      uid_tag);
-	if (!tag_stat_entry) {
-		
-		new_tag_stat = create_if_tag_stat(iface_entry, uid_tag);
-		uid_tag_counters = &new_tag_stat->counters;
-	} else {
-		uid_tag_counters = &tag_stat_entry->counters;
+	/* First packet for this tag on this iface, the stats get created */
+	spin_lock_bh(&iface_entry->tag_stat_list_lock);
+	tag_stat_entry = tag_stat_hash_search(iface_entry, tag);
+	if (tag_stat_entry)
+		goto update;
+
+	uid_tag_stat = tag_stat_hash_search(iface_entry, uid_tag);
+	if (!uid_tag_stat) {
+		uid_tag_stat = create_if_tag_stat(iface_entry, uid_tag, NULL);
+		if (!uid_tag_stat)
+			goto unlock_iface;
 	}
 
 	if (acct_tag) {
-		
-		new_tag_stat = create_if_tag_stat(iface_entry, tag);
-		new_tag_stat->parent_counters = uid_tag_counters;
+		tag_stat_entry = create_if_tag_stat(iface_entry, tag,
+						    uid_tag_stat);
+		if (!tag_stat_entry)
+			goto unlock_iface;
 	} else {
-		BUG_ON(!new_tag_stat);
+		tag_stat_entry = uid_tag_stat;
 	}
-	tag_stat_update(new_tag_stat, direction, proto, bytes);
+update:
+	tag_stat_update(tag_stat_entry, direction, proto, bytes);
+unlock_iface:
 	spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+unlock:
+	rcu_read_unlock_bh();
 }
 
 static int iface_netdev_event_handler(struct notifier_block *nb,
@@ -1830,7 +2079,7 @@ static int ctrl_cmd_delete(const char *input)
 			 input, st_entry->tag, entry_uid);
 
 		if (!acct_tag || st_entry->tag == tag) {
-			rb_erase(&st_entry->sock_node, &sock_tag_tree);
+			sock_tag_del(st_entry);
 			
 			sock_tag_tree_insert(st_entry, &st_to_free_tree);
 			tr_entry = lookup_tag_ref(st_entry->tag, NULL);
@@ -1847,16 +2096,16 @@ static int ctrl_cmd_delete(const char *input)
 	
 	spin_lock_bh(&tag_counter_set_list_lock);
 	
-	tcs_entry = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
+	tcs_entry = tag_counter_set_hash_search(tag);
 	if (tcs_entry) {
 		CT_DEBUG("qtaguid: ctrl_delete(%s): "
 			 "erase tcs: tag=0x%llx (uid=%u) set=%d\n",
 			 input,
-			 tcs_entry->tn.tag,
-			 get_uid_from_tag(tcs_entry->tn.tag),
+			 tcs_entry->tag,
+			 get_uid_from_tag(tcs_entry->tag),
 			 tcs_entry->active_set);
-		rb_erase(&tcs_entry->tn.node, &tag_counter_set_tree);
-		kfree(tcs_entry);
+		hlist_del_rcu(&tcs_entry->node);
+		call_rcu_bh(&tcs_entry->rcu, tag_counter_set_free_rcu);
 	}
 	spin_unlock_bh(&tag_counter_set_list_lock);
 
@@ -1881,9 +2130,7 @@ static int ctrl_cmd_delete(const char *input)
 					 input, iface_entry->ifname,
 					 get_atag_from_tag(ts_entry->tn.tag),
 					 entry_uid);
-				rb_erase(&ts_entry->tn.node,
-					 &iface_entry->tag_stat_tree);
-				kfree(ts_entry);
+				tag_stat_delete(ts_entry, iface_entry);
 			}
 		}
 		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
@@ -1949,7 +2196,7 @@ static int ctrl_cmd_counter_set(const char *input)
 
 	tag = make_tag_from_uid(uid);
 	spin_lock_bh(&tag_counter_set_list_lock);
-	tcs = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
+	tcs = tag_counter_set_hash_search(tag);
 	if (!tcs) {
 		tcs = kzalloc(sizeof(*tcs), GFP_ATOMIC);
 		if (!tcs) {
@@ -1960,8 +2207,8 @@ static int ctrl_cmd_counter_set(const char *input)
 			res = -ENOMEM;
 			goto err;
 		}
-		tcs->tn.tag = tag;
-		tag_counter_set_tree_insert(tcs, &tag_counter_set_tree);
+		tcs->tag = tag;
+		tag_counter_set_hash_insert(tcs);
 		CT_DEBUG("qtaguid: ctrl_counterset(%s): added tcs tag=0x%llx "
 			 "(uid=%u) set=%d\n",
 			 input, tag, get_uid_from_tag(tag), counter_set);
@@ -2054,7 +2301,9 @@ static int ctrl_cmd_tag(const char *input)
 		BUG_ON(IS_ERR_OR_NULL(prev_tag_ref_entry));
 		BUG_ON(prev_tag_ref_entry->num_sock_tags <= 0);
 		prev_tag_ref_entry->num_sock_tags--;
+		write_seqcount_begin(&sock_tag_seq);
 		sock_tag_entry->tag = full_tag;
+		write_seqcount_end(&sock_tag_seq);
 	} else {
 		CT_DEBUG("qtaguid: ctrl_tag(%s): newtag for sk=%p\n",
 			 input, el_socket->sk);
@@ -2088,7 +2337,7 @@ static int ctrl_cmd_tag(const char *input)
 				 &pqd_entry->sock_tag_list);
 		spin_unlock_bh(&uid_tag_data_tree_lock);
 
-		sock_tag_tree_insert(sock_tag_entry, &sock_tag_tree);
+		sock_tag_add(sock_tag_entry);
 		atomic64_inc(&qtu_events.sockets_tagged);
 	}
 	spin_unlock_bh(&sock_tag_list_lock);
@@ -2150,7 +2399,7 @@ static int ctrl_cmd_untag(const char *input)
 		res = -EINVAL;
 		goto err_put;
 	}
-	rb_erase(&sock_tag_entry->sock_node, &sock_tag_tree);
+	sock_tag_del(sock_tag_entry);
 
 	tag_ref_entry = lookup_tag_ref(sock_tag_entry->tag, &utd_entry);
 	BUG_ON(!tag_ref_entry);
@@ -2174,7 +2423,7 @@ static int ctrl_cmd_untag(const char *input)
 		 atomic_long_read(&el_socket->file->f_count) - 1);
 	sockfd_put(el_socket);
 
-	kfree(sock_tag_entry);
+	call_rcu_bh(&sock_tag_entry->rcu, sock_tag_free_rcu);
 	atomic64_inc(&qtu_events.sockets_untagged);
 
 	return 0;
@@ -2253,6 +2502,7 @@ struct proc_print_info {
 	char **num_items_returned;
 	struct iface_stat *iface_entry;
 	struct tag_stat *ts_entry;
+	struct data_counters ts_counters;
 	int item_index;
 	int items_to_skip;
 	int char_count;
@@ -2291,7 +2541,7 @@ static int pp_stats_line(struct proc_print_info *ppi, int cnt_set)
 		}
 		if (ppi->item_index++ < ppi->items_to_skip)
 			return 0;
-		cnts = &ppi->ts_entry->counters;
+		cnts = &ppi->ts_counters;
 		len = snprintf(
 			ppi->outp, ppi->char_count,
 			"%d %s 0x%llx %u %u "
@@ -2332,6 +2582,8 @@ static bool pp_sets(struct proc_print_info *ppi)
 {
 	int len;
 	int counter_set;
+
+	tag_stat_get_counters(ppi->ts_entry, &ppi->ts_counters);
 	for (counter_set = 0; counter_set < IFS_MAX_COUNTER_SETS;
 	     counter_set++) {
 		len = pp_stats_line(ppi, counter_set);
@@ -2416,6 +2668,233 @@ static int qtaguid_stats_proc_read(char *page, char **num_items_returned,
 	return ppi.outp - page;
 }
 
+struct stats_delta {
+	/* serializes build, read and write on one open file */
+	struct mutex lock;
+	/* cookie the next snapshot starts from */
+	unsigned long since;
+	void *buf;
+	size_t len;
+	size_t size;
+};
+
+static bool tag_stat_changed_since(struct tag_stat *ts, unsigned long gen)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (ACCESS_ONCE(ts->cpu_counters[cpu].gen) >= gen)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Returns the number of records added, or -ENOSPC if they do not all fit.
+ * Called with the iface list and the iface_entry's tag_stat_list_lock held.
+ */
+static int stats_delta_add_iface(struct stats_delta *sd,
+				 struct iface_stat *iface_entry,
+				 unsigned long since, int room)
+{
+	struct xt_qtaguid_stats_rec *rec = sd->buf + sd->len;
+	struct data_counters dc;
+	struct rb_node *node;
+	struct tag_stat *ts;
+	uid_t stat_uid;
+	int cnt_set;
+	int count = 0;
+
+	for (node = rb_first(&iface_entry->tag_stat_tree); node;
+	     node = rb_next(node)) {
+		ts = rb_entry(node, struct tag_stat, tn.node);
+		if (since && !tag_stat_changed_since(ts, since))
+			continue;
+		stat_uid = get_uid_from_tag(ts->tn.tag);
+		if (!can_read_other_uid_stats(stat_uid))
+			continue;
+		if (count + IFS_MAX_COUNTER_SETS > room)
+			return -ENOSPC;
+		tag_stat_get_counters(ts, &dc);
+		for (cnt_set = 0; cnt_set < IFS_MAX_COUNTER_SETS;
+		     cnt_set++, rec++, count++) {
+			strlcpy(rec->iface, iface_entry->ifname,
+				sizeof(rec->iface));
+			rec->acct_tag = get_atag_from_tag(ts->tn.tag);
+			rec->uid = stat_uid;
+			rec->cnt_set = cnt_set;
+			memcpy(rec->bpc, dc.bpc[cnt_set], sizeof(rec->bpc));
+		}
+	}
+	return count;
+}
+
+/*
+ * Wait for the counter updates that were in progress when stats_gen was
+ * bumped. Those may have stamped the old generation; any update started
+ * after the bump sees the new one. An update is a few counter stores
+ * with bh disabled, so this spins far shorter than a grace period.
+ */
+static void stats_delta_wait_updates(void)
+{
+	unsigned int seq;
+	int cpu;
+
+	smp_mb();
+	for_each_possible_cpu(cpu) {
+		seq = ACCESS_ONCE(per_cpu(stats_update_seq, cpu));
+		if (!(seq & 1))
+			continue;
+		while (ACCESS_ONCE(per_cpu(stats_update_seq, cpu)) == seq)
+			cpu_relax();
+	}
+	smp_rmb();
+}
+
+/*
+ * Bumping stats_gen and then waiting for the updates in progress means
+ * every update stamped with an older generation has landed by the time
+ * the tag_stats are read. So updates made after the read are stamped
+ * with the new cookie, and the next snapshot picks them up.
+ *
+ * Called with sd->lock held.
+ */
+static int qtaguid_stats_delta_build(struct stats_delta *sd)
+{
+	struct xt_qtaguid_stats_hdr *hdr;
+	struct iface_stat *iface_entry;
+	unsigned long since, cookie;
+	int room, res;
+	u32 count;
+
+	BUILD_BUG_ON(sizeof(((struct xt_qtaguid_stats_rec *)0)->bpc) !=
+		     sizeof(((struct data_counters *)0)->bpc[0]));
+	BUILD_BUG_ON(IFS_TX != XT_QTAGUID_STATS_TX ||
+		     IFS_RX != XT_QTAGUID_STATS_RX ||
+		     IFS_TCP != XT_QTAGUID_STATS_TCP ||
+		     IFS_UDP != XT_QTAGUID_STATS_UDP ||
+		     IFS_PROTO_OTHER != XT_QTAGUID_STATS_OTHER);
+
+	mutex_lock(&stats_delta_mutex);
+	cookie = ++stats_gen;
+	stats_delta_wait_updates();
+	since = sd->since;
+	if (since >= cookie || stats_reset_gen >= since)
+		since = 0;
+
+retry:
+	if (!sd->buf) {
+		sd->buf = vmalloc(sd->size);
+		if (!sd->buf) {
+			mutex_unlock(&stats_delta_mutex);
+			return -ENOMEM;
+		}
+	}
+	hdr = sd->buf;
+	sd->len = sizeof(*hdr);
+	count = 0;
+	if (likely(!module_passive)) {
+		spin_lock_bh(&iface_stat_list_lock);
+		list_for_each_entry(iface_entry, &iface_stat_list, list) {
+			room = (sd->size - sd->len) /
+				sizeof(struct xt_qtaguid_stats_rec);
+			spin_lock_bh(&iface_entry->tag_stat_list_lock);
+			res = stats_delta_add_iface(sd, iface_entry, since,
+						    room);
+			spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+			if (res < 0) {
+				spin_unlock_bh(&iface_stat_list_lock);
+				vfree(sd->buf);
+				sd->buf = NULL;
+				sd->size *= 2;
+				goto retry;
+			}
+			sd->len += res * sizeof(struct xt_qtaguid_stats_rec);
+			count += res;
+		}
+		spin_unlock_bh(&iface_stat_list_lock);
+	}
+	mutex_unlock(&stats_delta_mutex);
+
+	hdr->version = XT_QTAGUID_STATS_VERSION;
+	hdr->flags = since ? 0 : XT_QTAGUID_STATS_FULL;
+	hdr->cookie = cookie;
+	hdr->rec_size = sizeof(struct xt_qtaguid_stats_rec);
+	hdr->rec_count = count;
+	sd->since = cookie;
+	CT_DEBUG("qtaguid: %s(): cookie=%lu since=%lu records=%u\n",
+		 __func__, cookie, since, count);
+	return 0;
+}
+
+static int qtaguid_stats_delta_open(struct inode *inode, struct file *file)
+{
+	struct stats_delta *sd;
+
+	sd = kzalloc(sizeof(*sd), GFP_KERNEL);
+	if (!sd)
+		return -ENOMEM;
+	mutex_init(&sd->lock);
+	sd->size = PAGE_SIZE;
+	file->private_data = sd;
+	return 0;
+}
+
+static ssize_t qtaguid_stats_delta_read(struct file *file, char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	struct stats_delta *sd = file->private_data;
+	ssize_t res = 0;
+
+	mutex_lock(&sd->lock);
+	if (!*ppos)
+		res = qtaguid_stats_delta_build(sd);
+	if (!res && sd->buf)
+		res = simple_read_from_buffer(buf, count, ppos, sd->buf,
+					      sd->len);
+	mutex_unlock(&sd->lock);
+	return res;
+}
+
+static ssize_t qtaguid_stats_delta_write(struct file *file,
+					 const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	struct stats_delta *sd = file->private_data;
+	char input_buf[24];
+	unsigned long long cookie;
+
+	if (count >= sizeof(input_buf))
+		return -EINVAL;
+	if (copy_from_user(input_buf, buf, count))
+		return -EFAULT;
+	input_buf[count] = '\0';
+	if (kstrtoull(strim(input_buf), 10, &cookie))
+		return -EINVAL;
+	mutex_lock(&sd->lock);
+	sd->since = cookie > ULONG_MAX ? ULONG_MAX : cookie;
+	mutex_unlock(&sd->lock);
+	return count;
+}
+
+static int qtaguid_stats_delta_release(struct inode *inode, struct file *file)
+{
+	struct stats_delta *sd = file->private_data;
+
+	vfree(sd->buf);
+	kfree(sd);
+	return 0;
+}
+
+static const struct file_operations qtaguid_stats_delta_fops = {
+	.owner = THIS_MODULE,
+	.open = qtaguid_stats_delta_open,
+	.read = qtaguid_stats_delta_read,
+	.write = qtaguid_stats_delta_write,
+	.llseek = default_llseek,
+	.release = qtaguid_stats_delta_release,
+};
+
 static int qtudev_open(struct inode *inode, struct file *file)
 {
 	struct uid_tag_data *utd_entry;
@@ -2528,7 +3007,7 @@ static int qtudev_release(struct inode *inode, struct file *file)
 		tr->num_sock_tags--;
 		free_tag_ref_from_utd_entry(tr, utd_entry);
 
-		rb_erase(&st_entry->sock_node, &sock_tag_tree);
+		sock_tag_del(st_entry);
 		list_del(&st_entry->list);
 		
 		sock_tag_tree_insert(st_entry, &st_to_free_tree);
@@ -2597,8 +3076,21 @@ static int __init qtaguid_proc_register(struct proc_dir_entry **res_procdir)
 		goto no_stats_entry;
 	}
 	xt_qtaguid_stats_file->read_proc = qtaguid_stats_proc_read;
+
+	xt_qtaguid_stats_delta_file = proc_create("stats_delta",
+						  proc_stats_delta_perms,
+						  *res_procdir,
+						  &qtaguid_stats_delta_fops);
+	if (!xt_qtaguid_stats_delta_file) {
+		pr_err("qtaguid: failed to create xt_qtaguid/stats_delta "
+			"file\n");
+		ret = -ENOMEM;
+		goto no_stats_delta_entry;
+	}
 	return 0;
 
+no_stats_delta_entry:
+	remove_proc_entry("stats", *res_procdir);
 no_stats_entry:
 	remove_proc_entry("ctrl", *res_procdir);
 no_ctrl_entry:
@@ -2618,6 +3110,9 @@ static struct xt_match qtaguid_mt_reg __read_mostly = {
 
 static int __init qtaguid_mt_init(void)
 {
+	sock_tag_hash = sock_tag_hash_alloc(SOCK_TAG_HASH_MIN_BITS, GFP_KERNEL);
+	if (!sock_tag_hash)
+		return -ENOMEM;
 	if (qtaguid_proc_register(&xt_qtaguid_procdir)
 	    || iface_stat_init(xt_qtaguid_procdir)
 	    || xt_register_match(&qtaguid_mt_reg)
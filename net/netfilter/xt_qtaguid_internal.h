@@ -11,8 +11,13 @@
 #define __XT_QTAGUID_INTERNAL_H__
 
 #include <linux/types.h>
+#include <linux/cache.h>
+#include <linux/hash.h>
+#include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock_types.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/workqueue.h>
 
 #define IDEBUG_MASK (1<<0)
@@ -101,6 +106,14 @@ static inline tag_t make_atag_from_value(uint32_t value)
 	return (uint64_t)value << 32;
 }
 
+static inline u32 tag_hash(tag_t tag, unsigned int bits)
+{
+	return hash_32((u32)tag ^ (u32)(tag >> 32), bits);
+}
+
+#define TAG_STAT_HASH_BITS 8
+#define TAG_COUNTER_SET_HASH_BITS 6
+
 #define DEFAULT_MAX_SOCK_TAGS 1024
 
 #define IFS_MAX_COUNTER_SETS 2
@@ -127,6 +140,17 @@ struct data_counters {
 	struct byte_packet_counters bpc[IFS_MAX_COUNTER_SETS][IFS_MAX_DIRECTIONS][IFS_MAX_PROTOS];
 };
 
+/*
+ * The packet path only ever updates the copy of the counters that belongs
+ * to the cpu it runs on (with bh disabled). Readers add up all copies.
+ */
+struct data_counters_cpu {
+	struct data_counters counters;
+	struct u64_stats_sync syncp;
+	/* stats_gen at the last update, see qtaguid_stats_delta_build() */
+	unsigned long gen;
+} ____cacheline_aligned_in_smp;
+
 struct tag_node {
 	struct rb_node node;
 	tag_t tag;
@@ -134,10 +158,20 @@ struct tag_node {
 
 struct tag_stat {
 	struct tag_node tn;
-	struct data_counters counters;
-	struct data_counters *parent_counters;
+	/* In iface_stat.tag_stat_hash, for lookups under rcu_read_lock_bh */
+	struct hlist_node hash_node;
+	/* nr_cpu_ids entries */
+	struct data_counters_cpu *cpu_counters;
+	/* The uid only tag_stat, also updated for acct tagged traffic */
+	struct tag_stat *parent;
+	struct rcu_head rcu;
 };
 
+struct iface_skb_counters {
+	struct byte_packet_counters totals[IFS_MAX_DIRECTIONS];
+	struct u64_stats_sync syncp;
+} ____cacheline_aligned_in_smp;
+
 struct iface_stat {
 	struct list_head list;  
 	char *ifname;
@@ -146,7 +180,8 @@ struct iface_stat {
 	struct net_device *net_dev;
 
 	struct byte_packet_counters totals_via_dev[IFS_MAX_DIRECTIONS];
-	struct byte_packet_counters totals_via_skb[IFS_MAX_DIRECTIONS];
+	/* nr_cpu_ids entries, see iface_stat_get_skb_totals() */
+	struct iface_skb_counters *totals_via_skb;
 	struct byte_packet_counters last_known[IFS_MAX_DIRECTIONS];
 	
 	bool last_known_valid;
@@ -154,6 +189,8 @@ struct iface_stat {
 	struct proc_dir_entry *proc_ptr;
 
 	struct rb_root tag_stat_tree;
+	struct hlist_head tag_stat_hash[1 << TAG_STAT_HASH_BITS];
+	/* Serializes changes to the tree and the hash, not lookups */
 	spinlock_t tag_stat_list_lock;
 };
 
@@ -164,6 +201,13 @@ struct iface_stat_work {
 
 struct sock_tag {
 	struct rb_node sock_node;
+	/*
+	 * In the sock_tag_hash, for lookups under rcu_read_lock_bh. Resizing
+	 * links the entry into the new table through the other node, so the
+	 * old table stays intact for readers still walking it.
+	 */
+	struct hlist_node hash_node[2];
+	struct rcu_head rcu;
 	struct sock *sk;  
 	
 	struct socket *socket;
@@ -174,6 +218,17 @@ struct sock_tag {
 	tag_t tag;
 };
 
+struct sock_tag_hash {
+	unsigned int bits;
+	/* which sock_tag.hash_node links the entries of this table */
+	unsigned int idx;
+	struct rcu_head rcu;
+	struct hlist_head heads[0];
+};
+
+#define SOCK_TAG_HASH_MIN_BITS 8
+#define SOCK_TAG_HASH_MAX_BITS 12
+
 struct qtaguid_event_counts {
 	
 	atomic64_t sockets_tagged;
@@ -194,8 +249,10 @@ struct qtaguid_event_counts {
 };
 
 struct tag_counter_set {
-	struct tag_node tn;
+	struct hlist_node node;
+	tag_t tag;
 	int active_set;
+	struct rcu_head rcu;
 };
 
 struct uid_tag_data {
@@ -226,4 +283,8 @@ struct proc_qtu_data {
 	
 };
 
+void tag_stat_get_counters(struct tag_stat *ts, struct data_counters *dc);
+void iface_stat_get_skb_totals(struct iface_stat *iface,
+			       struct byte_packet_counters *totals);
+
 #endif  
@@ -146,7 +146,7 @@ char *pp_tag_stat(struct tag_stat *ts)
 {
 	char *tn_str;
 	char *counters_str;
-	char *parent_counters_str;
+	struct data_counters counters;
 	char *res;
 
 	if (!ts) {
@@ -155,24 +155,25 @@ char *pp_tag_stat(struct tag_stat *ts)
 		return res;
 	}
 	tn_str = pp_tag_node(&ts->tn);
-	counters_str = pp_data_counters(&ts->counters, true);
-	parent_counters_str = pp_data_counters(ts->parent_counters, false);
+	tag_stat_get_counters(ts, &counters);
+	counters_str = pp_data_counters(&counters, true);
 	res = kasprintf(GFP_ATOMIC,
-			"tag_stat@%p{%s, counters=%s, parent_counters=%s}",
-			ts, tn_str, counters_str, parent_counters_str);
+			"tag_stat@%p{%s, counters=%s, parent=%p}",
+			ts, tn_str, counters_str, ts->parent);
 	_bug_on_err_or_null(res);
 	kfree(tn_str);
 	kfree(counters_str);
-	kfree(parent_counters_str);
 	return res;
 }
 
 char *pp_iface_stat(struct iface_stat *is)
 {
+	struct byte_packet_counters skb_totals[IFS_MAX_DIRECTIONS];
 	char *res;
 	if (!is)
 		res = kasprintf(GFP_ATOMIC, "iface_stat@null{}");
-	else
+	else {
+		iface_stat_get_skb_totals(is, skb_totals);
 		res = kasprintf(GFP_ATOMIC, "iface_stat@%p{"
 				"list=list_head{...}, "
 				"ifname=%s, "
@@ -199,10 +200,10 @@ char *pp_iface_stat(struct iface_stat *is)
 				is->totals_via_dev[IFS_RX].packets,
 				is->totals_via_dev[IFS_TX].bytes,
 				is->totals_via_dev[IFS_TX].packets,
-				is->totals_via_skb[IFS_RX].bytes,
-				is->totals_via_skb[IFS_RX].packets,
-				is->totals_via_skb[IFS_TX].bytes,
-				is->totals_via_skb[IFS_TX].packets,
+				skb_totals[IFS_RX].bytes,
+				skb_totals[IFS_RX].packets,
+				skb_totals[IFS_TX].bytes,
+				skb_totals[IFS_TX].packets,
 				is->last_known_valid,
 				is->last_known[IFS_RX].bytes,
 				is->last_known[IFS_RX].packets,
@@ -211,6 +212,7 @@ char *pp_iface_stat(struct iface_stat *is)
 				is->active,
 				is->net_dev,
 				is->proc_ptr);
+	}
 	_bug_on_err_or_null(res);
 	return res;
 }
@@ -0,0 +1,279 @@
+/*
+ * Userspace copies of the frequency decisions made by the ondemand,
+ * interactive and smartmax governors in drivers/cpufreq, with their
+ * default tunables.  Only the part that turns a load sample into a
+ * frequency is kept; timers, idle notifiers, input boost and the
+ * multi-core coupling of ondemand are left out, so a trace is replayed
+ * one cpu at a time.
+ */
+
+#include <stdlib.h>
+
+#include "replay.h"
+
+static unsigned int clamp_freq(const struct gov_cpu *c, unsigned int khz)
+{
+	if (khz < c->min)
+		return c->min;
+	if (khz > c->max)
+		return c->max;
+	return khz;
+}
+
+unsigned int freq_at_least(const struct gov_cpu *c, unsigned int khz)
+{
+	const struct freq_table *t = c->tbl;
+	unsigned int i;
+
+	khz = clamp_freq(c, khz);
+	for (i = 0; i < t->nr; i++)
+		if (t->khz[i] >= khz && t->khz[i] <= c->max)
+			return t->khz[i];
+	return c->max;
+}
+
+unsigned int freq_at_most(const struct gov_cpu *c, unsigned int khz)
+{
+	const struct freq_table *t = c->tbl;
+	unsigned int i;
+
+	khz = clamp_freq(c, khz);
+	for (i = t->nr; i-- > 0; )
+		if (t->khz[i] <= khz && t->khz[i] >= c->min)
+			return t->khz[i];
+	return c->min;
+}
+
+static unsigned int load_of(unsigned int busy_us, unsigned int window_us)
+{
+	if (!window_us || busy_us > window_us)
+		return window_us ? 100 : 0;
+	return 100 * busy_us / window_us;
+}
+
+/* ondemand: dbs_check_cpu() */
+
+#define OD_UP_THRESHOLD		80
+#define OD_DOWN_DIFFERENTIAL	10
+
+static unsigned int od_sample(struct gov_cpu *c, unsigned int busy_us,
+			      unsigned int window_us)
+{
+	unsigned int max_load_freq = load_of(busy_us, window_us) * c->cur;
+	unsigned int freq_next;
+
+	if (max_load_freq > OD_UP_THRESHOLD * c->cur)
+		return c->max;
+
+	if (c->cur == c->min)
+		return c->cur;
+
+	if (max_load_freq < (OD_UP_THRESHOLD - OD_DOWN_DIFFERENTIAL) * c->cur) {
+		freq_next = max_load_freq /
+			    (OD_UP_THRESHOLD - OD_DOWN_DIFFERENTIAL);
+		return freq_at_least(c, freq_next);
+	}
+	return c->cur;
+}
+
+static const struct governor ondemand = {
+	.name		= "ondemand",
+	.period_us	= 50000,
+	.sample		= od_sample,
+};
+
+/* interactive: cpufreq_interactive_timer() */
+
+#define IA_GO_HISPEED_LOAD	85
+#define IA_MIN_SAMPLE_TIME	80000
+#define IA_ABOVE_HISPEED_DELAY	20000
+
+struct ia_cpu {
+	unsigned int target_freq;
+	unsigned int floor_freq;
+	uint64_t floor_validate_time;
+	uint64_t hispeed_validate_time;
+	/* busy and total time since the last frequency change */
+	uint64_t busy_since_change;
+	uint64_t time_since_change;
+};
+
+static int ia_init(struct gov_cpu *c)
+{
+	struct ia_cpu *p = calloc(1, sizeof(*p));
+
+	if (!p)
+		return -1;
+	p->target_freq = c->cur;
+	p->floor_freq = c->cur;
+	c->priv = p;
+	return 0;
+}
+
+static unsigned int ia_sample(struct gov_cpu *c, unsigned int busy_us,
+			      unsigned int window_us)
+{
+	struct ia_cpu *p = c->priv;
+	unsigned int hispeed_freq = c->max;
+	unsigned int cpu_load, load_since_change, new_freq;
+
+	p->busy_since_change += busy_us;
+	p->time_since_change += window_us;
+
+	cpu_load = load_of(busy_us, window_us);
+	load_since_change = load_of(p->busy_since_change,
+				    p->time_since_change);
+	if (load_since_change > cpu_load)
+		cpu_load = load_since_change;
+
+	if (cpu_load >= IA_GO_HISPEED_LOAD) {
+		if (p->target_freq <= c->min) {
+			new_freq = hispeed_freq;
+		} else {
+			new_freq = c->max * cpu_load / 100;
+			if (new_freq < hispeed_freq)
+				new_freq = hispeed_freq;
+			if (p->target_freq == hispeed_freq &&
+			    new_freq > hispeed_freq &&
+			    c->now - p->hispeed_validate_time <
+			    IA_ABOVE_HISPEED_DELAY)
+				return p->target_freq;
+		}
+	} else {
+		new_freq = c->max * cpu_load / 100;
+	}
+
+	if (new_freq <= hispeed_freq)
+		p->hispeed_validate_time = c->now;
+
+	new_freq = freq_at_most(c, new_freq);
+
+	if (new_freq < p->floor_freq &&
+	    c->now - p->floor_validate_time < IA_MIN_SAMPLE_TIME)
+		return p->target_freq;
+
+	p->floor_freq = new_freq;
+	p->floor_validate_time = c->now;
+
+	if (p->target_freq != new_freq) {
+		p->target_freq = new_freq;
+		p->busy_since_change = 0;
+		p->time_since_change = 0;
+	}
+	return p->target_freq;
+}
+
+static void ia_exit(struct gov_cpu *c)
+{
+	free(c->priv);
+}
+
+static const struct governor interactive = {
+	.name		= "interactive",
+	.period_us	= 20000,
+	.init		= ia_init,
+	.sample		= ia_sample,
+	.exit		= ia_exit,
+};
+
+/*
+ * smartmax: cpufreq_smartmax_get_ramp_direction() and
+ * cpufreq_smartmax_freq_change().  A ramp up also needs more than one
+ * runnable task, which a load trace does not record; it is assumed.
+ */
+
+#define SM_IDEAL_FREQ		475000
+#define SM_RAMP_UP_STEP		300000
+#define SM_RAMP_DOWN_STEP	150000
+#define SM_MAX_CPU_LOAD		80
+#define SM_MIN_CPU_LOAD		50
+#define SM_UP_RATE		40000
+#define SM_DOWN_RATE		80000
+
+struct sm_cpu {
+	uint64_t freq_change_time;
+};
+
+static int sm_init(struct gov_cpu *c)
+{
+	struct sm_cpu *p = calloc(1, sizeof(*p));
+
+	if (!p)
+		return -1;
+	c->priv = p;
+	return 0;
+}
+
+/* target_freq(): never settle on the frequency we are leaving */
+static unsigned int sm_target(struct gov_cpu *c, unsigned int new_freq,
+			      int relation_h)
+{
+	struct sm_cpu *p = c->priv;
+	unsigned int old_freq = c->cur;
+	unsigned int target;
+
+	new_freq = clamp_freq(c, new_freq);
+	if (new_freq == old_freq)
+		return old_freq;
+
+	target = relation_h ? freq_at_most(c, new_freq) :
+			      freq_at_least(c, new_freq);
+	if (target == old_freq) {
+		if (new_freq > old_freq && relation_h)
+			target = freq_at_least(c, new_freq);
+		else if (new_freq < old_freq && !relation_h)
+			target = freq_at_most(c, new_freq);
+	}
+	if (target == old_freq)
+		return old_freq;
+
+	p->freq_change_time = c->now;
+	return target;
+}
+
+static unsigned int sm_sample(struct gov_cpu *c, unsigned int busy_us,
+			      unsigned int window_us)
+{
+	struct sm_cpu *p = c->priv;
+	unsigned int load = load_of(busy_us, window_us);
+	unsigned int cur = c->cur;
+
+	if (load > SM_MAX_CPU_LOAD && cur < c->max &&
+	    (cur < SM_IDEAL_FREQ ||
+	     c->now - p->freq_change_time >= SM_UP_RATE)) {
+		if (cur < SM_IDEAL_FREQ)
+			return sm_target(c, SM_IDEAL_FREQ, 0);
+		return sm_target(c, cur + SM_RAMP_UP_STEP, 1);
+	}
+
+	if (load < SM_MIN_CPU_LOAD && cur > c->min &&
+	    (cur > SM_IDEAL_FREQ ||
+	     c->now - p->freq_change_time >= SM_DOWN_RATE)) {
+		if (cur > SM_IDEAL_FREQ)
+			return sm_target(c, SM_IDEAL_FREQ, 1);
+		return sm_target(c, cur > SM_RAMP_DOWN_STEP ?
+				 cur - SM_RAMP_DOWN_STEP : 0, 0);
+	}
+
+	return cur;
+}
+
+static void sm_exit(struct gov_cpu *c)
+{
+	free(c->priv);
+}
+
+static const struct governor smartmax = {
+	.name		= "smartmax",
+	.period_us	= 40000,
+	.init		= sm_init,
+	.sample		= sm_sample,
+	.exit		= sm_exit,
+};
+
+const struct governor *governors[] = {
+	&ondemand,
+	&interactive,
+	&smartmax,
+	NULL,
+};
@@ -0,0 +1,333 @@
+/*
+ * cpufreq-replay: replay a recorded load trace through userspace copies
+ * of the cpufreq governors and compare how they would have behaved.
+ *
+ * Record a trace on the device with the cpufreq_governor_load event of
+ * any governor enabled:
+ *
+ *	echo 1 > /sys/kernel/debug/tracing/events/cpufreq_governor/enable
+ *	... run the workload ...
+ *	cat /sys/kernel/debug/tracing/trace > load.trace
+ *
+ * and replay it with "cpufreq-replay load.trace".  Lines of the form
+ * "<seconds> <cpu> <load> <khz>" are accepted as well, for synthetic
+ * traces.
+ *
+ * Each sample is turned into the work the cpu had to do, load percent of
+ * the frequency it ran at, and that demand is held until the next sample.
+ * The replay then steps through the trace, lets each governor pick
+ * frequencies at its own sampling rate, and reports per cpu:
+ *
+ *  - latency to target: how long the cpu ran below the lowest frequency
+ *    that covers the demand, per such episode;
+ *  - unserved work: demand above the current frequency, as a share of
+ *    all demand;
+ *  - estimated energy, from a frequency/voltage table (-p) and
+ *    P = k * f * V^2 while busy, plus a small idle share.
+ *
+ * A sample at 100% load only says the demand was at least the current
+ * frequency, so latencies after saturation are lower bounds.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "replay.h"
+
+#define MAX_CPUS	8
+#define MW_PER_MHZ_V2	0.45	/* roughly 1 W for a Krait core at 1.5 GHz */
+#define IDLE_SHARE	0.05
+
+struct sample {
+	uint64_t t;		/* us */
+	unsigned int demand;	/* kHz worth of work */
+};
+
+struct trace {
+	struct sample *s;
+	unsigned int nr, size;
+	unsigned int first_khz;
+};
+
+struct result {
+	unsigned int changes;
+	double avg_khz;
+	unsigned int episodes;
+	double lat_sum, lat_max;	/* us */
+	double unserved, demand;	/* kHz * us */
+	double energy;			/* mJ */
+};
+
+/* APQ8064 Krait, nominal voltages */
+static struct freq_table table = {
+	.nr = 14,
+	.khz = { 384000, 486000, 594000, 702000, 810000, 918000, 1026000,
+		 1134000, 1242000, 1350000, 1458000, 1566000, 1674000,
+		 1728000 },
+	.mv = { 950, 975, 1000, 1025, 1075, 1100, 1125, 1150, 1175, 1200,
+		1225, 1237, 1250, 1262 },
+};
+
+static struct trace traces[MAX_CPUS];
+static unsigned int tick_us = 1000;
+
+static int load_table(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	unsigned int khz, mv;
+	char line[256];
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	table.nr = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%u %u", &khz, &mv) != 2)
+			continue;
+		if (table.nr == MAX_FREQS ||
+		    (table.nr && khz <= table.khz[table.nr - 1])) {
+			fprintf(stderr, "%s: need at most %d ascending "
+				"frequencies\n", path, MAX_FREQS);
+			fclose(f);
+			return -1;
+		}
+		table.khz[table.nr] = khz;
+		table.mv[table.nr] = mv;
+		table.nr++;
+	}
+	fclose(f);
+	if (!table.nr) {
+		fprintf(stderr, "%s: no \"<khz> <mV>\" lines\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static int add_sample(double sec, unsigned int cpu, unsigned int load,
+		      unsigned int khz)
+{
+	struct trace *tr;
+
+	if (cpu >= MAX_CPUS || load > 100 || !khz)
+		return 0;
+	tr = &traces[cpu];
+	if (tr->nr == tr->size) {
+		tr->size = tr->size ? tr->size * 2 : 1024;
+		tr->s = realloc(tr->s, tr->size * sizeof(*tr->s));
+		if (!tr->s)
+			return -1;
+	}
+	if (!tr->nr)
+		tr->first_khz = khz;
+	tr->s[tr->nr].t = sec * 1e6;
+	tr->s[tr->nr].demand = (uint64_t)khz * load / 100;
+	tr->nr++;
+	return 0;
+}
+
+static int parse_line(char *line)
+{
+	static const char event[] = " cpufreq_governor_load: ";
+	unsigned int cpu, load, khz;
+	char *p, *ts;
+	double sec;
+
+	p = strstr(line, event);
+	if (!p) {
+		if (sscanf(line, "%lf %u %u %u", &sec, &cpu, &load, &khz) == 4)
+			return add_sample(sec, cpu, load, khz);
+		return 0;
+	}
+
+	/* the timestamp is the "<sec>.<usec>:" just before the event */
+	*p = '\0';
+	ts = strrchr(line, ' ');
+	if (!ts || sscanf(ts, " %lf:", &sec) != 1)
+		return 0;
+	if (sscanf(p + sizeof(event) - 1, "governor=%*s cpu=%u load=%u cur=%u",
+		   &cpu, &load, &khz) != 3)
+		return 0;
+	return add_sample(sec, cpu, load, khz);
+}
+
+static double power_mw(unsigned int khz, double util)
+{
+	unsigned int i;
+	double v, busy;
+
+	for (i = 0; i < table.nr - 1 && table.khz[i] < khz; i++)
+		;
+	v = table.mv[i] / 1000.0;
+	busy = MW_PER_MHZ_V2 * (khz / 1000.0) * v * v;
+	return busy * (util + (1 - util) * IDLE_SHARE);
+}
+
+static int replay(const struct governor *gov, struct trace *tr,
+		  struct result *r)
+{
+	struct gov_cpu c = {
+		.tbl = &table,
+		.min = table.khz[0],
+		.max = table.khz[table.nr - 1],
+	};
+	uint64_t t, end, next_sample, under_since = 0;
+	unsigned int i = 0, busy = 0, window = 0;
+	unsigned int required, demand;
+	double util, khz_us = 0;
+	int under = 0;
+
+	memset(r, 0, sizeof(*r));
+	c.cur = freq_at_least(&c, tr->first_khz);
+	c.now = tr->s[0].t;
+	if (gov->init && gov->init(&c))
+		return -1;
+
+	end = tr->s[tr->nr - 1].t;
+	next_sample = c.now + gov->period_us;
+	for (t = tr->s[0].t; t < end; t += tick_us) {
+		while (i + 1 < tr->nr && tr->s[i + 1].t <= t)
+			i++;
+		demand = tr->s[i].demand;
+		c.now = t;
+
+		util = demand >= c.cur ? 1.0 : (double)demand / c.cur;
+		busy += util * tick_us;
+		window += tick_us;
+		khz_us += (double)c.cur * tick_us;
+		r->energy += power_mw(c.cur, util) * tick_us / 1e6;
+		r->demand += (double)demand * tick_us;
+
+		required = freq_at_least(&c, demand);
+		if (c.cur < required) {
+			if (!under) {
+				under = 1;
+				under_since = t;
+			}
+			r->unserved += (double)(demand - c.cur) * tick_us;
+		} else if (under) {
+			under = 0;
+			r->episodes++;
+			r->lat_sum += t - under_since;
+			if (t - under_since > r->lat_max)
+				r->lat_max = t - under_since;
+		}
+
+		if (t + tick_us >= next_sample) {
+			unsigned int next = gov->sample(&c, busy, window);
+
+			if (next != c.cur)
+				r->changes++;
+			c.cur = next;
+			busy = window = 0;
+			next_sample += gov->period_us;
+		}
+	}
+	if (under) {
+		r->episodes++;
+		r->lat_sum += t - under_since;
+		if (t - under_since > r->lat_max)
+			r->lat_max = t - under_since;
+	}
+	if (end > tr->s[0].t)
+		r->avg_khz = khz_us / (end - tr->s[0].t);
+
+	if (gov->exit)
+		gov->exit(&c);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-g governor[,governor...]] "
+		"[-p freq-voltage table] [-t tick us] trace|-\n", prog);
+	exit(2);
+}
+
+static int selected(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p;
+
+	if (!list)
+		return 1;
+	for (p = list; (p = strstr(p, name)); p += len)
+		if ((p == list || p[-1] == ',') &&
+		    (p[len] == ',' || p[len] == '\0'))
+			return 1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const struct governor **gov;
+	const char *list = NULL;
+	struct result r;
+	char line[512];
+	unsigned int cpu;
+	FILE *f;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "g:p:t:")) != -1) {
+		switch (opt) {
+		case 'g':
+			list = optarg;
+			break;
+		case 'p':
+			if (load_table(optarg))
+				return 1;
+			break;
+		case 't':
+			tick_us = atoi(optarg);
+			if (!tick_us)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (parse_line(line)) {
+			perror("reading trace");
+			return 1;
+		}
+	}
+	if (f != stdin)
+		fclose(f);
+
+	printf("%-12s %3s %7s %8s %8s %9s %9s %9s %10s\n", "governor", "cpu",
+	       "changes", "avg_MHz", "episodes", "lat_avg", "lat_max",
+	       "unserved", "energy_mJ");
+	for (gov = governors; *gov; gov++) {
+		if (!selected(list, (*gov)->name))
+			continue;
+		for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+			if (traces[cpu].nr < 2)
+				continue;
+			if (replay(*gov, &traces[cpu], &r)) {
+				fprintf(stderr, "%s: %s\n", (*gov)->name,
+					strerror(errno));
+				return 1;
+			}
+			printf("%-12s %3u %7u %8.0f %8u %7.1fms %7.1fms "
+			       "%8.2f%% %10.1f\n", (*gov)->name, cpu,
+			       r.changes, r.avg_khz / 1000, r.episodes,
+			       r.episodes ? r.lat_sum / r.episodes / 1000 : 0,
+			       r.lat_max / 1000,
+			       r.demand ? 100 * r.unserved / r.demand : 0,
+			       r.energy);
+		}
+	}
+	return 0;
+}
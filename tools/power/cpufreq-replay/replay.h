@@ -0,0 +1,45 @@
+#ifndef _CPUFREQ_REPLAY_H
+#define _CPUFREQ_REPLAY_H
+
+#include <stdint.h>
+
+#define MAX_FREQS	32
+
+struct freq_table {
+	unsigned int nr;
+	unsigned int khz[MAX_FREQS];	/* ascending */
+	unsigned int mv[MAX_FREQS];
+};
+
+/* what a governor sees of one cpu */
+struct gov_cpu {
+	const struct freq_table *tbl;
+	unsigned int cur;
+	unsigned int min;
+	unsigned int max;
+	uint64_t now;			/* us */
+	void *priv;
+};
+
+/*
+ * The decision part of a kernel governor.  sample() is called every
+ * period_us with the time the cpu was busy during the period and returns
+ * the frequency to run at next.
+ */
+struct governor {
+	const char *name;
+	unsigned int period_us;
+	int (*init)(struct gov_cpu *c);
+	unsigned int (*sample)(struct gov_cpu *c, unsigned int busy_us,
+			       unsigned int window_us);
+	void (*exit)(struct gov_cpu *c);
+};
+
+extern const struct governor *governors[];
+
+/* lowest frequency >= khz, like CPUFREQ_RELATION_L */
+unsigned int freq_at_least(const struct gov_cpu *c, unsigned int khz);
+/* highest frequency <= khz, like CPUFREQ_RELATION_H */
+unsigned int freq_at_most(const struct gov_cpu *c, unsigned int khz);
+
+#endif
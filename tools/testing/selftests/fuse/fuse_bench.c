@@ -0,0 +1,340 @@
+/*
+ * Reply throughput of /dev/fuse against the number of requests in flight.
+ *
+ * Mounts a one-file filesystem served by a minimal daemon that speaks the
+ * FUSE protocol directly.  N client threads read the file with direct I/O,
+ * so every read is a FUSE_READ request.  The daemon collects up to N
+ * outstanding reads before it answers them, newest first, so each reply
+ * is written while N requests are waiting in the processing queue and has
+ * to be matched against them.  With a hashed reply lookup the rate should
+ * stay flat as N grows.
+ *
+ * usage: fuse_bench [-t seconds] [depth ...]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/fuse.h>
+
+#define FILE_INO	2
+#define FILE_NAME	"data"
+#define FILE_SIZE	(1ULL << 30)
+#define READ_SIZE	4096
+#define MAX_DEPTH	1024
+#define BUF_SIZE	(FUSE_MIN_READ_BUFFER + 128 * 1024)
+
+struct pending {
+	uint64_t unique;
+	uint32_t size;
+};
+
+static int fuse_fd;
+static char mnt[] = "/tmp/fuse_bench.XXXXXX";
+static char file_path[sizeof(mnt) + sizeof(FILE_NAME)];
+static volatile int depth = 1;
+static volatile int stop_clients;
+static long replies, batches;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void reply(uint64_t unique, int error, const void *arg, size_t size)
+{
+	struct fuse_out_header out;
+	struct iovec iov[2];
+
+	out.unique = unique;
+	out.error = error;
+	out.len = sizeof(out) + size;
+	iov[0].iov_base = &out;
+	iov[0].iov_len = sizeof(out);
+	iov[1].iov_base = (void *)arg;
+	iov[1].iov_len = size;
+	if (writev(fuse_fd, iov, size ? 2 : 1) < 0 && errno != ENOENT)
+		perror("reply");
+}
+
+static void fill_attr(struct fuse_attr *attr, uint64_t ino)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = ino;
+	if (ino == FUSE_ROOT_ID) {
+		attr->mode = S_IFDIR | 0755;
+		attr->nlink = 2;
+	} else {
+		attr->mode = S_IFREG | 0444;
+		attr->nlink = 1;
+		attr->size = FILE_SIZE;
+		attr->blocks = FILE_SIZE / 512;
+	}
+}
+
+/* answers everything but reads, which are returned for batching */
+static int handle(struct fuse_in_header *in, struct pending *p)
+{
+	void *arg = in + 1;
+
+	switch (in->opcode) {
+	case FUSE_INIT: {
+		struct fuse_init_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.major = FUSE_KERNEL_VERSION;
+		out.minor = ((struct fuse_init_in *)arg)->minor;
+		if (out.minor > FUSE_KERNEL_MINOR_VERSION)
+			out.minor = FUSE_KERNEL_MINOR_VERSION;
+		out.max_write = 128 * 1024;
+		/* the fields every kernel since 7.13 understands */
+		reply(in->unique, 0, &out,
+		      offsetof(struct fuse_init_out, max_write) +
+		      sizeof(out.max_write));
+		break;
+	}
+	case FUSE_LOOKUP: {
+		struct fuse_entry_out out;
+
+		if (in->nodeid != FUSE_ROOT_ID || strcmp(arg, FILE_NAME)) {
+			reply(in->unique, -ENOENT, NULL, 0);
+			break;
+		}
+		memset(&out, 0, sizeof(out));
+		out.nodeid = FILE_INO;
+		out.entry_valid = out.attr_valid = 3600;
+		fill_attr(&out.attr, FILE_INO);
+		reply(in->unique, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_GETATTR: {
+		struct fuse_attr_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.attr_valid = 3600;
+		fill_attr(&out.attr, in->nodeid);
+		reply(in->unique, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_OPEN: {
+		struct fuse_open_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.open_flags = FOPEN_DIRECT_IO;
+		reply(in->unique, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_READ:
+		p->unique = in->unique;
+		p->size = ((struct fuse_read_in *)arg)->size;
+		return 1;
+	case FUSE_FLUSH:
+	case FUSE_RELEASE:
+		reply(in->unique, 0, NULL, 0);
+		break;
+	case FUSE_FORGET:
+	case FUSE_BATCH_FORGET:
+	case FUSE_INTERRUPT:
+		break;
+	default:
+		reply(in->unique, -ENOSYS, NULL, 0);
+		break;
+	}
+	return 0;
+}
+
+static void *daemon_fn(void *unused)
+{
+	static char zeroes[128 * 1024];
+	static struct pending batch[MAX_DEPTH];
+	struct pollfd pfd = { .fd = fuse_fd, .events = POLLIN };
+	char *buf = malloc(BUF_SIZE);
+	int nr = 0, timeout;
+	ssize_t n;
+
+	(void)unused;
+	if (!buf)
+		return NULL;
+
+	for (;;) {
+		/* wait for the batch to fill up, but not for stragglers */
+		timeout = nr ? 1 : -1;
+		if (nr < depth && poll(&pfd, 1, timeout) > 0) {
+			n = read(fuse_fd, buf, BUF_SIZE);
+			if (n < 0) {
+				if (errno == EINTR || errno == ENOENT)
+					continue;
+				break;	/* ENODEV: unmounted */
+			}
+			nr += handle((struct fuse_in_header *)buf, &batch[nr]);
+			if (nr < depth)
+				continue;
+		}
+		if (!nr)
+			continue;
+
+		/* newest first: the worst order for a list walk */
+		pthread_mutex_lock(&stats_lock);
+		replies += nr;
+		batches++;
+		pthread_mutex_unlock(&stats_lock);
+		while (nr--) {
+			uint32_t size = batch[nr].size;
+
+			if (size > sizeof(zeroes))
+				size = sizeof(zeroes);
+			reply(batch[nr].unique, 0, zeroes, size);
+		}
+		nr = 0;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void *client_fn(void *arg)
+{
+	char buf[READ_SIZE];
+	off_t off = (long)arg * (FILE_SIZE / MAX_DEPTH);
+	int fd;
+
+	fd = open(file_path, O_RDONLY);
+	if (fd < 0) {
+		perror(file_path);
+		return NULL;
+	}
+	while (!stop_clients) {
+		if (pread(fd, buf, sizeof(buf), off) < 0) {
+			perror("pread");
+			break;
+		}
+		off = (off + READ_SIZE) % FILE_SIZE;
+	}
+	close(fd);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int run(int nr, int seconds)
+{
+	static pthread_t clients[MAX_DEPTH];
+	double start, elapsed;
+	long r, b;
+	int i;
+
+	pthread_mutex_lock(&stats_lock);
+	replies = batches = 0;
+	pthread_mutex_unlock(&stats_lock);
+	depth = nr;
+	stop_clients = 0;
+
+	start = now();
+	for (i = 0; i < nr; i++)
+		if (pthread_create(&clients[i], NULL, client_fn,
+				   (void *)(long)i)) {
+			perror("pthread_create");
+			nr = i;
+			stop_clients = 1;
+			break;
+		}
+	sleep(seconds);
+	stop_clients = 1;
+	for (i = 0; i < nr; i++)
+		pthread_join(clients[i], NULL);
+	elapsed = now() - start;
+
+	pthread_mutex_lock(&stats_lock);
+	r = replies;
+	b = batches;
+	pthread_mutex_unlock(&stats_lock);
+	printf("depth %4d: %9.0f replies/s, %6.1f requests in flight\n",
+	       nr, r / elapsed, b ? (double)r / b : 0);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const int default_depths[] = { 1, 8, 32, 128, 512 };
+	char opts[128];
+	pthread_t daemon;
+	int seconds = 3;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t seconds] [depth ...]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (seconds < 1)
+		seconds = 1;
+
+	fuse_fd = open("/dev/fuse", O_RDWR);
+	if (fuse_fd < 0) {
+		perror("/dev/fuse");
+		return 1;
+	}
+	if (!mkdtemp(mnt)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(opts, sizeof(opts), "fd=%d,rootmode=40000,user_id=0,"
+		 "group_id=0,allow_other", fuse_fd);
+	if (mount("fuse_bench", mnt, "fuse", MS_NOSUID | MS_NODEV, opts)) {
+		perror("mount");
+		rmdir(mnt);
+		return 1;
+	}
+	snprintf(file_path, sizeof(file_path), "%s/%s", mnt, FILE_NAME);
+
+	if (pthread_create(&daemon, NULL, daemon_fn, NULL)) {
+		perror("pthread_create");
+		umount2(mnt, MNT_DETACH);
+		rmdir(mnt);
+		return 1;
+	}
+
+	if (optind < argc) {
+		for (i = optind; i < argc; i++) {
+			int d = atoi(argv[i]);
+
+			if (d < 1 || d > MAX_DEPTH) {
+				fprintf(stderr, "depth must be 1..%d\n",
+					MAX_DEPTH);
+				break;
+			}
+			run(d, seconds);
+		}
+	} else {
+		for (i = 0; i < (int)(sizeof(default_depths) /
+				      sizeof(default_depths[0])); i++)
+			run(default_depths[i], seconds);
+	}
+
+	umount2(mnt, MNT_DETACH);
+	pthread_join(daemon, NULL);
+	close(fuse_fd);
+	rmdir(mnt);
+	return 0;
+}
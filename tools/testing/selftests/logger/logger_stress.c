@@ -0,0 +1,262 @@
+/*
+ * Stress test and write throughput benchmark for the Android logger.
+ *
+ * Several threads append numbered entries to a log concurrently while a
+ * reader drains it and checks every entry it sees: the payload must be
+ * intact and each writer's entries must arrive in order.  Entries that
+ * were overwritten before the reader got to them are counted as lost,
+ * which is legitimate for a ring buffer; anything else is a failure.
+ *
+ * usage: logger_stress [-d device] [-w writers] [-n entries per writer]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* From drivers/staging/android/logger.h */
+struct user_logger_entry_compat {
+	uint16_t	len;
+	uint16_t	__pad;
+	int32_t		pid;
+	int32_t		tid;
+	int32_t		sec;
+	int32_t		nsec;
+	char		msg[0];
+};
+
+#define LOGGER_ENTRY_MAX_PAYLOAD	4076
+
+#define MAX_WRITERS	64
+#define MAX_FILL	200
+
+static const char *device;
+static int nr_writers = 4;
+static long nr_entries = 100000;
+static char tag[32];
+
+static volatile int writers_done;
+static long next_seq[MAX_WRITERS];
+static long received, lost, bad;
+
+static int fill_len(int writer, long seq)
+{
+	return (writer * 31 + seq) % MAX_FILL;
+}
+
+static char fill_char(int writer, long seq)
+{
+	return 'a' + (writer + seq) % 26;
+}
+
+static void *writer_fn(void *arg)
+{
+	int writer = (long)arg;
+	char prio = 4;	/* ANDROID_LOG_INFO */
+	char msg[64 + MAX_FILL];
+	struct iovec vec[3];
+	long seq;
+	int fd, len;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0) {
+		perror(device);
+		exit(1);
+	}
+
+	for (seq = 0; seq < nr_entries; seq++) {
+		len = sprintf(msg, "%d %ld ", writer, seq);
+		memset(msg + len, fill_char(writer, seq),
+		       fill_len(writer, seq));
+		len += fill_len(writer, seq);
+		msg[len++] = '\0';
+
+		vec[0].iov_base = &prio;
+		vec[0].iov_len = 1;
+		vec[1].iov_base = tag;
+		vec[1].iov_len = strlen(tag) + 1;
+		vec[2].iov_base = msg;
+		vec[2].iov_len = len;
+		if (writev(fd, vec, 3) < 0) {
+			perror("writev");
+			exit(1);
+		}
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void check_entry(struct user_logger_entry_compat *entry, ssize_t n)
+{
+	char *payload = entry->msg;
+	char *msg, *p;
+	int writer, i;
+	long seq;
+
+	if (n != (ssize_t)(sizeof(*entry) + entry->len)) {
+		fprintf(stderr, "entry length %u does not match read %zd\n",
+			entry->len, n);
+		bad++;
+		return;
+	}
+
+	/* skip other loggers' entries */
+	if (entry->len < 2 || strncmp(payload + 1, tag, entry->len - 1))
+		return;
+
+	msg = payload + 1 + strlen(tag) + 1;
+	if (sscanf(msg, "%d %ld ", &writer, &seq) != 2 ||
+	    writer < 0 || writer >= nr_writers) {
+		fprintf(stderr, "malformed entry '%.40s'\n", msg);
+		bad++;
+		return;
+	}
+
+	p = strchr(strchr(msg, ' ') + 1, ' ') + 1;
+	for (i = 0; i < fill_len(writer, seq); i++)
+		if (p[i] != fill_char(writer, seq))
+			break;
+	if (i != fill_len(writer, seq) || p[i] != '\0' ||
+	    p + i + 1 != payload + entry->len) {
+		fprintf(stderr, "corrupt payload for writer %d seq %ld\n",
+			writer, seq);
+		bad++;
+		return;
+	}
+
+	if (seq < next_seq[writer]) {
+		fprintf(stderr, "writer %d: seq %ld after %ld\n",
+			writer, seq, next_seq[writer] - 1);
+		bad++;
+		return;
+	}
+	lost += seq - next_seq[writer];
+	next_seq[writer] = seq + 1;
+	received++;
+}
+
+static void *reader_fn(void *arg)
+{
+	int fd = (long)arg;
+	char buf[sizeof(struct user_logger_entry_compat) +
+		 LOGGER_ENTRY_MAX_PAYLOAD + 1] __attribute__((aligned(4)));
+	ssize_t n;
+
+	for (;;) {
+		n = read(fd, buf, sizeof(buf) - 1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				perror("read");
+				exit(1);
+			}
+			if (writers_done)
+				break;
+			usleep(1000);
+			continue;
+		}
+		buf[n] = '\0';
+		check_entry((struct user_logger_entry_compat *)buf, n);
+	}
+
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	char drain[sizeof(struct user_logger_entry_compat) +
+		   LOGGER_ENTRY_MAX_PAYLOAD];
+	pthread_t writers[MAX_WRITERS], reader;
+	double start, elapsed;
+	long i, total;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "d:w:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'w':
+			nr_writers = atoi(optarg);
+			break;
+		case 'n':
+			nr_entries = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d device] [-w writers] "
+				"[-n entries per writer]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (nr_writers < 1 || nr_writers > MAX_WRITERS || nr_entries < 1) {
+		fprintf(stderr, "writers must be 1..%d, entries positive\n",
+			MAX_WRITERS);
+		return 2;
+	}
+	if (!device)
+		device = access("/dev/log/main", F_OK) ? "/dev/log_main" :
+							 "/dev/log/main";
+	snprintf(tag, sizeof(tag), "logger_stress.%d", getpid());
+
+	/* read only what is written from here on */
+	fd = open(device, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(device);
+		return 1;
+	}
+	while (read(fd, drain, sizeof(drain)) > 0)
+		;
+
+	if (pthread_create(&reader, NULL, reader_fn, (void *)(long)fd)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < nr_writers; i++)
+		if (pthread_create(&writers[i], NULL, writer_fn, (void *)i)) {
+			perror("pthread_create");
+			return 1;
+		}
+	for (i = 0; i < nr_writers; i++)
+		pthread_join(writers[i], NULL);
+	elapsed = now() - start;
+
+	writers_done = 1;
+	pthread_join(reader, NULL);
+	close(fd);
+
+	total = nr_writers * nr_entries;
+	for (i = 0; i < nr_writers; i++)
+		lost += nr_entries - next_seq[i];
+
+	printf("%d writers, %ld entries in %.3f s: %.0f entries/s\n",
+	       nr_writers, total, elapsed, total / elapsed);
+	printf("reader: %ld received, %ld overwritten, %ld bad\n",
+	       received, lost, bad);
+
+	if (bad || received + lost != total) {
+		printf("[FAIL]\n");
+		return 1;
+	}
+	printf("[PASS]\n");
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Packet rate benchmark for the qtaguid socket tag lookup.
+ *
+ * Tags an increasing number of idle UDP sockets, then blasts small
+ * datagrams over the loopback device from one more tagged socket and
+ * reports the packet rate.  With iptables rules that send loopback
+ * traffic through the owner/qtaguid match (see run_qtaguid_bench), every
+ * packet looks up its socket's tag, so the rate should stay flat as the
+ * number of tagged sockets grows.
+ *
+ * usage: qtaguid_bench [-t seconds] [socket count ...]
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CTRL_PATH	"/proc/net/xt_qtaguid/ctrl"
+#define DEV_PATH	"/dev/xt_qtaguid"
+
+static int ctrl_fd;
+
+static int ctrl_cmd(const char *fmt, int sock, uint32_t tag)
+{
+	char cmd[64];
+	int len;
+
+	len = snprintf(cmd, sizeof(cmd), fmt, sock,
+		       (unsigned long long)tag << 32, getuid());
+	if (write(ctrl_fd, cmd, len) != len) {
+		perror(cmd);
+		return -1;
+	}
+	return 0;
+}
+
+static int tag_socket(int sock, uint32_t tag)
+{
+	return ctrl_cmd("t %d %llu %u", sock, tag);
+}
+
+static int untag_socket(int sock)
+{
+	return ctrl_cmd("u %d", sock, 0);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double blast(int tx, int rx, struct sockaddr_in *dst, int seconds)
+{
+	char buf[64];
+	double start, end, t;
+	long sent = 0;
+
+	memset(buf, 0x5a, sizeof(buf));
+	start = now();
+	end = start + seconds;
+	do {
+		int i;
+
+		for (i = 0; i < 256; i++) {
+			if (sendto(tx, buf, sizeof(buf), MSG_DONTWAIT,
+				   (struct sockaddr *)dst, sizeof(*dst)) > 0)
+				sent++;
+			while (recv(rx, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+				;
+		}
+		t = now();
+	} while (t < end);
+
+	return sent / (t - start);
+}
+
+static int run(int nr_socks, int seconds)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int *socks, tx, rx, i, ret = -1;
+	double pps;
+
+	socks = calloc(nr_socks, sizeof(*socks));
+	if (!socks)
+		return -1;
+
+	for (i = 0; i < nr_socks; i++) {
+		socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (socks[i] < 0) {
+			perror("socket");
+			nr_socks = i;
+			goto out;
+		}
+		if (tag_socket(socks[i], i + 1)) {
+			close(socks[i]);
+			nr_socks = i;
+			goto out;
+		}
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	rx = socket(AF_INET, SOCK_DGRAM, 0);
+	tx = socket(AF_INET, SOCK_DGRAM, 0);
+	if (rx < 0 || tx < 0 ||
+	    bind(rx, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    getsockname(rx, (struct sockaddr *)&addr, &len)) {
+		perror("loopback sockets");
+		goto out_close;
+	}
+	if (tag_socket(tx, 0x7fffffff) || tag_socket(rx, 0x7ffffffe))
+		goto out_close;
+
+	pps = blast(tx, rx, &addr, seconds);
+	printf("%6d tagged sockets: %10.0f packets/s\n", nr_socks, pps);
+	ret = 0;
+
+	untag_socket(tx);
+	untag_socket(rx);
+out_close:
+	if (rx >= 0)
+		close(rx);
+	if (tx >= 0)
+		close(tx);
+out:
+	for (i = 0; i < nr_socks; i++) {
+		untag_socket(socks[i]);
+		close(socks[i]);
+	}
+	free(socks);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	static const int default_counts[] = { 0, 100, 1000, 4000, 16000 };
+	struct rlimit rl;
+	int seconds = 2;
+	int dev_fd, opt, i;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t seconds] "
+				"[socket count ...]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (seconds < 1)
+		seconds = 1;
+
+	/* room for the largest socket count */
+	rl.rlim_cur = rl.rlim_max = 20000;
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	/* qtaguid wants tagging processes to hold its device open */
+	dev_fd = open(DEV_PATH, O_RDONLY);
+	ctrl_fd = open(CTRL_PATH, O_WRONLY);
+	if (ctrl_fd < 0) {
+		perror(CTRL_PATH);
+		return 1;
+	}
+
+	if (optind < argc) {
+		for (i = optind; i < argc && !ret; i++)
+			ret = run(atoi(argv[i]), seconds);
+	} else {
+		for (i = 0; i < (int)(sizeof(default_counts) /
+				      sizeof(default_counts[0])) && !ret; i++)
+			ret = run(default_counts[i], seconds);
+	}
+
+	close(ctrl_fd);
+	if (dev_fd >= 0)
+		close(dev_fd);
+	return ret ? 1 : 0;
+}
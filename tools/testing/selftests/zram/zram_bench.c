@@ -0,0 +1,320 @@
+/*
+ * Compressor benchmark for zram on real page dumps.
+ *
+ * Pages are taken from the anonymous, writable mappings of the running
+ * processes (or from a dump file given with -i), written to a zram
+ * device once per compression algorithm and read back.  For each
+ * algorithm the compression ratio, the memory used and the write and
+ * read throughput are reported, and the data read back is checked
+ * against what was written.
+ *
+ * usage: zram_bench [-d zramN] [-i dump] [-o dump] [-m max MB] [algo...]
+ *
+ * Without algorithms on the command line, every algorithm listed in
+ * comp_algorithm is measured.  -o saves the collected pages so later
+ * runs can use the same input.  Needs root, and the device must not be
+ * in use: it is reset between algorithms.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define PAGE_SZ		4096
+#define CHUNK		(64 * 1024)
+#define MAX_ALGOS	16
+
+static const char *zram = "zram0";
+static char *dump;
+static size_t dump_len, dump_max = 64 << 20;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int sysfs_write(const char *attr, const char *val)
+{
+	char path[128];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", zram, attr);
+	fd = open(path, O_WRONLY);
+	if (fd < 0 || write(fd, val, strlen(val)) < 0)
+		ret = -errno;
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+static int sysfs_read(const char *attr, char *buf, size_t len)
+{
+	char path[128];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", zram, attr);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -errno;
+	buf[n] = '\0';
+	return 0;
+}
+
+static unsigned long long sysfs_ull(const char *attr)
+{
+	char buf[64];
+
+	if (sysfs_read(attr, buf, sizeof(buf)))
+		return 0;
+	return strtoull(buf, NULL, 0);
+}
+
+static void add_pages(int fd, unsigned long start, unsigned long end)
+{
+	unsigned long addr;
+
+	for (addr = start; addr < end && dump_len < dump_max; addr += PAGE_SZ)
+		if (pread(fd, dump + dump_len, PAGE_SZ, addr) == PAGE_SZ)
+			dump_len += PAGE_SZ;
+}
+
+/*
+ * Copy the private writable anonymous memory of every process: heaps,
+ * stacks and anonymous mappings, which is what ends up in zram swap.
+ */
+static void collect_pages(void)
+{
+	char path[288], line[512], perms[8], name[256];
+	unsigned long start, end;
+	struct dirent *de;
+	DIR *proc;
+	FILE *maps;
+	int fd;
+
+	proc = opendir("/proc");
+	if (!proc) {
+		perror("/proc");
+		exit(1);
+	}
+	while ((de = readdir(proc)) && dump_len < dump_max) {
+		if (!isdigit(de->d_name[0]) || atoi(de->d_name) == getpid())
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/maps", de->d_name);
+		maps = fopen(path, "r");
+		if (!maps)
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/mem", de->d_name);
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			fclose(maps);
+			continue;
+		}
+		while (fgets(line, sizeof(line), maps) && dump_len < dump_max) {
+			name[0] = '\0';
+			if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %255s",
+				   &start, &end, perms, name) < 3)
+				continue;
+			if (strcmp(perms, "rw-p"))
+				continue;
+			if (name[0] && strcmp(name, "[heap]") &&
+			    strcmp(name, "[stack]") &&
+			    strncmp(name, "[anon:", 6))
+				continue;
+			add_pages(fd, start, end);
+		}
+		close(fd);
+		fclose(maps);
+	}
+	closedir(proc);
+}
+
+static void load_dump(const char *file)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		perror(file);
+		exit(1);
+	}
+	while (dump_len < dump_max &&
+	       (n = read(fd, dump + dump_len, dump_max - dump_len)) > 0)
+		dump_len += n;
+	close(fd);
+	dump_len &= ~(size_t)(PAGE_SZ - 1);
+}
+
+static void save_dump(const char *file)
+{
+	int fd;
+
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || write(fd, dump, dump_len) != (ssize_t)dump_len) {
+		perror(file);
+		exit(1);
+	}
+	close(fd);
+}
+
+static int open_zram(void)
+{
+	char path[64];
+	int fd;
+
+	snprintf(path, sizeof(path), "/dev/block/%s", zram);
+	fd = open(path, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		snprintf(path, sizeof(path), "/dev/%s", zram);
+		fd = open(path, O_RDWR | O_DIRECT);
+	}
+	if (fd < 0)
+		perror(path);
+	return fd;
+}
+
+static int run_algo(const char *algo, char *buf)
+{
+	unsigned long long orig, compr, used, zero;
+	double t0, t_write, t_read;
+	char size[32];
+	size_t off;
+	int fd, bad = 0;
+
+	sysfs_write("reset", "1");
+	if (sysfs_write("comp_algorithm", algo)) {
+		printf("%-10s not available\n", algo);
+		return 0;
+	}
+	snprintf(size, sizeof(size), "%zu", dump_len);
+	if (sysfs_write("disksize", size)) {
+		fprintf(stderr, "%s: cannot set disksize\n", zram);
+		return -1;
+	}
+
+	fd = open_zram();
+	if (fd < 0)
+		return -1;
+
+	t0 = now();
+	for (off = 0; off < dump_len; off += CHUNK) {
+		size_t len = dump_len - off < CHUNK ? dump_len - off : CHUNK;
+
+		memcpy(buf, dump + off, len);
+		if (pwrite(fd, buf, len, off) != (ssize_t)len) {
+			perror("write");
+			close(fd);
+			return -1;
+		}
+	}
+	fsync(fd);
+	t_write = now() - t0;
+
+	orig = sysfs_ull("orig_data_size");
+	compr = sysfs_ull("compr_data_size");
+	used = sysfs_ull("mem_used_total");
+	zero = sysfs_ull("zero_pages");
+
+	t0 = now();
+	for (off = 0; off < dump_len; off += CHUNK) {
+		size_t len = dump_len - off < CHUNK ? dump_len - off : CHUNK;
+
+		if (pread(fd, buf, len, off) != (ssize_t)len) {
+			perror("read");
+			close(fd);
+			return -1;
+		}
+		if (memcmp(buf, dump + off, len))
+			bad++;
+	}
+	t_read = now() - t0;
+	close(fd);
+
+	printf("%-10s %7.3f %9llu %9llu %7llu %10.1f %10.1f%s\n", algo,
+	       compr ? (double)orig / compr : 0.0, compr >> 10, used >> 10,
+	       zero, dump_len / t_write / (1 << 20),
+	       dump_len / t_read / (1 << 20), bad ? "  MISMATCH" : "");
+	return bad ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *in = NULL, *out = NULL;
+	char *algos[MAX_ALGOS], list[256], *tok, *buf;
+	int nr_algos = 0, opt, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:i:o:m:")) != -1) {
+		switch (opt) {
+		case 'd':
+			zram = optarg;
+			break;
+		case 'i':
+			in = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'm':
+			dump_max = strtoul(optarg, NULL, 0) << 20;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d zramN] [-i dump] "
+				"[-o dump] [-m max MB] [algo...]\n", argv[0]);
+			return 1;
+		}
+	}
+	for (i = optind; i < argc && nr_algos < MAX_ALGOS; i++)
+		algos[nr_algos++] = argv[i];
+
+	if (!nr_algos) {
+		if (sysfs_read("comp_algorithm", list, sizeof(list))) {
+			fprintf(stderr, "%s: no comp_algorithm attribute\n",
+				zram);
+			return 1;
+		}
+		for (tok = strtok(list, " []\n"); tok && nr_algos < MAX_ALGOS;
+		     tok = strtok(NULL, " []\n"))
+			algos[nr_algos++] = tok;
+	}
+
+	dump = malloc(dump_max);
+	if (!dump || posix_memalign((void **)&buf, PAGE_SZ, CHUNK)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	if (in)
+		load_dump(in);
+	else
+		collect_pages();
+	if (!dump_len) {
+		fprintf(stderr, "no pages to test with\n");
+		return 1;
+	}
+	if (out)
+		save_dump(out);
+
+	printf("%zu pages from %s\n", dump_len / PAGE_SZ, in ? in : "/proc");
+	printf("%-10s %7s %9s %9s %7s %10s %10s\n", "algorithm", "ratio",
+	       "compr KB", "used KB", "zero", "write MB/s", "read MB/s");
+	for (i = 0; i < nr_algos; i++)
+		if (run_algo(algos[i], buf))
+			ret = 1;
+
+	sysfs_write("reset", "1");
+	return ret;
+}
@@ -0,0 +1,279 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -g -o mtp-test mtp-test.c */
+
+/*
+ * Bulk throughput and data integrity test for the MTP gadget function.
+ *
+ * Meant to be run on a machine that is both USB host and device, with
+ * dummy_hcd as the UDC and the Android gadget exporting mtp:
+ *
+ *	modprobe dummy_hcd
+ *	echo mtp > /sys/class/android_usb/android0/functions
+ *	echo 1 > /sys/class/android_usb/android0/enable
+ *	./mtp-test /dev/bus/usb/BBB/DDD
+ *
+ * A child process plays the MTP responder on /dev/mtp_usb: it receives
+ * a file with MTP_RECEIVE_FILE and then sends it back with MTP_SEND_FILE.
+ * The parent plays the host through usbfs, writing a known pattern to
+ * the bulk OUT endpoint and checking what comes back on bulk IN.  The
+ * rate of each direction is reported, so request size and count tuning
+ * of the function can be compared without a real phone and PC.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <linux/usb/ch9.h>
+#include <linux/usbdevice_fs.h>
+
+/* from include/linux/usb/f_mtp.h */
+struct mtp_file_range {
+	int		fd;
+	int64_t		offset;
+	int64_t		length;
+	uint16_t	command;
+	uint32_t	transaction_id;
+};
+
+#define MTP_SEND_FILE		_IOW('M', 0, struct mtp_file_range)
+#define MTP_RECEIVE_FILE	_IOW('M', 1, struct mtp_file_range)
+
+#define MTP_DEV		"/dev/mtp_usb"
+#define CHUNK		16384	/* usbfs bulk transfer limit */
+#define TIMEOUT_MS	5000
+
+static unsigned ep_in, ep_out, maxpacket, intf = ~0u;
+
+static uint8_t pattern(uint64_t off)
+{
+	/* changes every byte and does not repeat at page boundaries */
+	return ((off * 2654435761u) >> 13) ^ (off / 4093);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int responder(const char *path, int64_t size)
+{
+	struct mtp_file_range mfr;
+	int mtp, fd;
+
+	mtp = open(MTP_DEV, O_RDWR);
+	if (mtp < 0) {
+		perror(MTP_DEV);
+		return 1;
+	}
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	memset(&mfr, 0, sizeof(mfr));
+	mfr.fd = fd;
+	mfr.length = size;
+	if (ioctl(mtp, MTP_RECEIVE_FILE, &mfr)) {
+		perror("MTP_RECEIVE_FILE");
+		return 1;
+	}
+	if (ioctl(mtp, MTP_SEND_FILE, &mfr)) {
+		perror("MTP_SEND_FILE");
+		return 1;
+	}
+
+	close(fd);
+	close(mtp);
+	return 0;
+}
+
+/* find the MTP (or PTP) interface and its bulk endpoints */
+static int parse_descriptors(int dev)
+{
+	unsigned char buf[4096], *p;
+	int len, cur = -1;
+
+	len = read(dev, buf, sizeof(buf));
+	if (len < USB_DT_DEVICE_SIZE) {
+		perror("reading descriptors");
+		return -1;
+	}
+
+	for (p = buf + USB_DT_DEVICE_SIZE; p + 2 <= buf + len && p[0];
+	     p += p[0]) {
+		if (p[1] == USB_DT_INTERFACE) {
+			struct usb_interface_descriptor *d = (void *)p;
+
+			if (intf != ~0u)
+				break;
+			if ((d->bInterfaceClass == USB_CLASS_VENDOR_SPEC &&
+			     d->bInterfaceSubClass == 0xff) ||
+			    d->bInterfaceClass == USB_CLASS_STILL_IMAGE)
+				cur = d->bInterfaceNumber;
+			else
+				cur = -1;
+		} else if (p[1] == USB_DT_ENDPOINT && cur >= 0) {
+			struct usb_endpoint_descriptor *d = (void *)p;
+
+			if ((d->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) !=
+			    USB_ENDPOINT_XFER_BULK)
+				continue;
+			if (d->bEndpointAddress & USB_DIR_IN)
+				ep_in = d->bEndpointAddress;
+			else
+				ep_out = d->bEndpointAddress;
+			maxpacket = __le16_to_cpu(d->wMaxPacketSize);
+			if (ep_in && ep_out)
+				intf = cur;
+		}
+	}
+
+	if (intf == ~0u) {
+		fprintf(stderr, "no MTP interface found\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int bulk(int dev, unsigned ep, void *data, unsigned len)
+{
+	struct usbdevfs_bulktransfer bt;
+
+	bt.ep = ep;
+	bt.len = len;
+	bt.timeout = TIMEOUT_MS;
+	bt.data = data;
+	return ioctl(dev, USBDEVFS_BULK, &bt);
+}
+
+static int host_out(int dev, int64_t size)
+{
+	unsigned char buf[CHUNK];
+	int64_t off;
+	unsigned i, len;
+	double start;
+
+	start = now();
+	for (off = 0; off < size; off += len) {
+		len = size - off < CHUNK ? size - off : CHUNK;
+		for (i = 0; i < len; i++)
+			buf[i] = pattern(off + i);
+		if (bulk(dev, ep_out, buf, len) != (int)len) {
+			perror("bulk OUT");
+			return -1;
+		}
+	}
+	printf("host -> device: %lld bytes, %.2f MB/s\n", (long long)size,
+	       size / (now() - start) / 1e6);
+	return 0;
+}
+
+static int host_in(int dev, int64_t size)
+{
+	unsigned char buf[CHUNK];
+	int64_t off;
+	double start;
+	int i, len;
+
+	start = now();
+	for (off = 0; off < size; off += len) {
+		len = bulk(dev, ep_in, buf, CHUNK);
+		if (len <= 0) {
+			perror("bulk IN");
+			return -1;
+		}
+		if (off + len > size) {
+			fprintf(stderr, "device sent %lld bytes too many\n",
+				(long long)(off + len - size));
+			return -1;
+		}
+		for (i = 0; i < len; i++) {
+			if (buf[i] != pattern(off + i)) {
+				fprintf(stderr, "data mismatch at %lld\n",
+					(long long)(off + i));
+				return -1;
+			}
+		}
+	}
+	/* a transfer that ends on a packet boundary is closed by a ZLP */
+	if (!(size % maxpacket))
+		bulk(dev, ep_in, buf, CHUNK);
+	printf("device -> host: %lld bytes, %.2f MB/s\n", (long long)size,
+	       size / (now() - start) / 1e6);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *file = "/tmp/mtp-test.dat";
+	int64_t size = 64 << 20;
+	int dev, opt, status, ret;
+	pid_t child;
+
+	while ((opt = getopt(argc, argv, "f:s:")) != -1) {
+		switch (opt) {
+		case 'f':
+			file = optarg;
+			break;
+		case 's':
+			size = strtoll(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || size <= 0) {
+usage:
+		fprintf(stderr, "usage: %s [-f responder file] [-s bytes] "
+			"/dev/bus/usb/BBB/DDD\n", argv[0]);
+		return 2;
+	}
+
+	dev = open(argv[optind], O_RDWR);
+	if (dev < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (parse_descriptors(dev))
+		return 1;
+	if (ioctl(dev, USBDEVFS_CLAIMINTERFACE, &intf)) {
+		perror("USBDEVFS_CLAIMINTERFACE");
+		return 1;
+	}
+
+	child = fork();
+	if (child < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!child)
+		exit(responder(file, size));
+
+	ret = host_out(dev, size) || host_in(dev, size);
+	if (ret)
+		kill(child, SIGTERM);
+
+	waitpid(child, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		ret = 1;
+	unlink(file);
+
+	ioctl(dev, USBDEVFS_RELEASEINTERFACE, &intf);
+	close(dev);
+	printf(ret ? "[FAIL]\n" : "[PASS]\n");
+	return ret;
+}